@@ -0,0 +1,46 @@
+#ifndef ANN_SINK_H_
+#define ANN_SINK_H_
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "tar_writer.h"
+
+// 一个 patch 的标注，坐标已经换算到 patch 上
+typedef struct {
+  std::string id;        // patch 名，不含扩展名
+  std::string file_name; // 图像文件名
+  size_t width;
+  size_t height;
+  std::vector<double> bboxes; // 每个对象 8 个值
+  std::vector<int> labels;    // class_dict 中的全局类别编号
+  std::vector<unsigned char> diffs;
+  std::vector<unsigned char> trunc; // 对象被窗口截断
+} patch_ann_t;
+
+// 追加 DOTA 格式的标注文本: 每个对象一行 "8 个坐标 类别 难度"，截断的对象
+// 难度记为 2，最后一行没有换行符
+void append_dota_ann(std::string& out, const patch_ann_t& ann,
+                     const int& precision);
+
+// patch 标注的输出，write 可以被多个线程同时调用
+class ann_sink {
+ public:
+  virtual ~ann_sink() {}
+  virtual void write(const patch_ann_t& ann) = 0;
+  // 所有 patch 写完后调用一次，写出文件结尾
+  virtual void close() {}
+};
+
+// format 为 "dota" 时 path 是目录，每个 patch 一个 txt 文件;
+// "jsonl" 每个 patch 一行 JSON; "coco" 为 COCO 格式的单个 JSON 文件。
+// 后两者流式写入 path，precision 为坐标的小数位数 (0 时截断为整数)。
+// tar 不为空时 "dota" 的 txt 写入调用线程的 tar 分片，紧跟在图像之后
+std::unique_ptr<ann_sink> make_ann_sink(const std::string& format,
+                                        const std::string& path,
+                                        const int& precision,
+                                        tar_output* tar = nullptr);
+
+#endif
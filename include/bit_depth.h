@@ -0,0 +1,59 @@
+#ifndef BIT_DEPTH_H_
+#define BIT_DEPTH_H_
+
+#include <gdal_priv.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "read_utils.h"
+
+// 每个波段的线性拉伸区间 [lo, hi]
+typedef struct {
+  std::vector<double> lo;
+  std::vector<double> hi;
+} stretch_t;
+
+// 在最长边不超过 max_size 的采样上统计每个波段的拉伸区间，图像有概览时 GDAL
+// 直接读取概览。method 为 "minmax" 或 "percentile" (percent[0]% 和 percent[1]%
+// 分位数)，跳过 nodata 和 NaN
+stretch_t compute_stretch(GDALDataset* dataset, const std::string& method,
+                          const std::vector<double>& percent,
+                          const size_t& max_size = 1024);
+
+// 把 patch 原地转换为 8 位: out = 255 * ((v - lo) / (hi - lo))^(1 / gamma)。
+// 8/16 位整数直接查表，其它类型先由 SIMD 内核量化到 12 位再查表。
+// 查找表每张图像建立一次，convert 可以被多个线程同时调用
+class depth_converter {
+ public:
+  depth_converter(const GDALDataType& data_type, const int& nchannels,
+                  const stretch_t& stretch, const double& gamma);
+
+  void convert(patch_t& patch) const;
+
+ private:
+  GDALDataType _data_type;
+  int _nchannels;
+  size_t _lut_size;            // 每个波段的表项数
+  std::vector<unsigned char> _lut;
+  std::vector<float> _offset;  // 量化参数，按 8 * nchannels 个元素的周期展开
+  std::vector<float> _scale;
+  // 按数据类型和波段数选择的查表内核
+  void (*_lookup)(const unsigned char*, const unsigned char*, const size_t&,
+                  const int&, const int&, unsigned char*, const size_t&);
+};
+
+// 量化内核: dst[i] = round(clamp((src[i] - offset[j]) * scale[j], 0, 4095))，
+// j = i % period，period 为 8 的倍数。NaN 量化为 0，各指令集结果逐位一致
+void quantize_row_scalar(const float* src, const float* offset,
+                         const float* scale, const size_t& period,
+                         unsigned short* dst, const size_t& n);
+void quantize_row_sse2(const float* src, const float* offset,
+                       const float* scale, const size_t& period,
+                       unsigned short* dst, const size_t& n);
+void quantize_row_avx2(const float* src, const float* offset,
+                       const float* scale, const size_t& period,
+                       unsigned short* dst, const size_t& n);
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef BOUNDED_QUEUE_HPP_
+#define BOUNDED_QUEUE_HPP_
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+// 有界阻塞队列: 满时 push 阻塞，生产者全部结束后调用 close，
+// 之后 pop 取完剩余元素再返回 false
+template <typename T> class bounded_queue {
+ public:
+  explicit bounded_queue(const size_t &capacity)
+      : _capacity(std::max<size_t>(capacity, 1)), _closed(false) {}
+
+  void push(T value) {
+    std::unique_lock<std::mutex> lock(_lock);
+    _not_full.wait(lock,
+                   [this] { return _queue.size() < _capacity || _closed; });
+    _queue.push_back(std::move(value));
+    _not_empty.notify_one();
+  }
+
+  bool try_push(T &value) {
+    std::lock_guard<std::mutex> lock(_lock);
+    if (_queue.size() >= _capacity) {
+      return false;
+    }
+    _queue.push_back(std::move(value));
+    _not_empty.notify_one();
+    return true;
+  }
+
+  bool pop(T &value) {
+    std::unique_lock<std::mutex> lock(_lock);
+    _not_empty.wait(lock, [this] { return !_queue.empty() || _closed; });
+    if (_queue.empty()) {
+      return false;
+    }
+    value = std::move(_queue.front());
+    _queue.pop_front();
+    _not_full.notify_one();
+    return true;
+  }
+
+  bool try_pop(T &value) {
+    std::lock_guard<std::mutex> lock(_lock);
+    if (_queue.empty()) {
+      return false;
+    }
+    value = std::move(_queue.front());
+    _queue.pop_front();
+    _not_full.notify_one();
+    return true;
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> lock(_lock);
+    _closed = true;
+    _not_empty.notify_all();
+    _not_full.notify_all();
+  }
+
+ private:
+  size_t _capacity;
+  bool _closed;
+  std::deque<T> _queue;
+  std::mutex _lock;
+  std::condition_variable _not_empty;
+  std::condition_variable _not_full;
+};
+
+#endif
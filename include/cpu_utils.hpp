@@ -0,0 +1,52 @@
+#ifndef CPU_UTILS_HPP_
+#define CPU_UTILS_HPP_
+
+#include <string>
+
+namespace cpu {
+
+enum SimdLevel { kScalar = 0, kSSE2 = 1, kAVX2 = 2 };
+
+inline SimdLevel detect_simd_level() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return kAVX2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return kSSE2;
+  }
+#endif
+  return kScalar;
+}
+
+inline SimdLevel &simd_level_ref() {
+  static SimdLevel level = detect_simd_level();
+  return level;
+}
+
+// 运行时选择的指令集，各 SIMD 内核据此分派
+inline SimdLevel simd_level() { return simd_level_ref(); }
+
+// 配置可以把指令集降到 "sse2" 或 "scalar" (参考实现)，但不能超过 CPU 支持的级别
+inline bool set_simd_level(const std::string &name) {
+  SimdLevel level;
+  if (name == "auto") {
+    level = detect_simd_level();
+  } else if (name == "avx2") {
+    level = kAVX2;
+  } else if (name == "sse2") {
+    level = kSSE2;
+  } else if (name == "scalar") {
+    level = kScalar;
+  } else {
+    return false;
+  }
+  const SimdLevel max_level = detect_simd_level();
+  simd_level_ref() = level < max_level ? level : max_level;
+  return true;
+}
+
+} // namespace cpu
+
+#endif
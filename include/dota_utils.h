@@ -1,16 +1,61 @@
 #ifndef DOTA_UTILS_H_
 #define DOTA_UTILS_H_
 
+#include <gdal.h>
+
+#include <deque>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+// 全局类别字典，标注中只保存类别 id，输出时才取回类别名
+class class_dict {
+ public:
+  static class_dict& instance();
+
+  // 固定类别表 (列表或 "dota1.0"/"dota1.5"/"dota2.0")，id 按表中顺序，
+  // 之后不在表中的类别被过滤
+  void set_classes(const std::vector<std::string>& classes);
+  void set_classes(const std::string& preset);
+
+  // 返回类别 id，固定类别表中找不到时返回 -1
+  int intern(const std::string& name);
+  const std::string& name(const int& id) const;
+  size_t size() const;
+
+ private:
+  class_dict() : _fixed(false) {}
+
+  mutable std::mutex _lock;
+  bool _fixed;
+  std::unordered_map<std::string, int> _ids;
+  std::deque<std::string> _names; // push_back 不会使已有元素的引用失效
+};
+
+// 按类别 id 计数
+typedef std::vector<size_t> class_stats_t;
+
+void count_classes(const std::vector<int>& labels, class_stats_t& stats);
+
+void merge_class_stats(const class_stats_t& src, class_stats_t& dst);
+
+void log_class_stats(const std::string& title, const class_stats_t& stats);
+
+// 扁平的标注表: 第 i 个对象的 8 个坐标为 bboxes[8 * i, 8 * i + 8)，
+// labels[i] 为 class_dict 中的类别 id
 typedef struct {
-  std::vector<std::vector<double>> bboxes;
-  std::vector<std::string> labels;
-  std::vector<int> diffs;
-  std::vector<bool> trunc;
+  std::vector<double> bboxes;
+  std::vector<int> labels;
+  std::vector<unsigned char> diffs;
 } ann_t;
 
+// 窗口按下标引用 content_t::ann 中的对象
+typedef struct {
+  std::vector<unsigned int> inds;
+  std::vector<unsigned char> trunc;
+} window_ann_t;
+
 typedef struct {
   float gsd;
   std::string filename;
@@ -18,9 +63,19 @@ typedef struct {
   size_t width;
   size_t height;
   ann_t ann;
+  int nchannels;
+  GDALDataType data_type;
+  std::string compression; // 大写的压缩方式，如 NONE/DEFLATE/LZW/JPEG
 } content_t;
 
+// 读取单张图像的尺寸和标注，不支持的图像格式返回 false
+bool load_dota_single(const std::string& img_file, const std::string& ann_dir,
+                      content_t& content);
+
 std::vector<content_t> load_dota(const std::string& img_dir,
                                  const std::string& ann_dir,
                                  const int& nthread = 10);
+
+// 返回上次调用以来因不在固定类别表中被忽略的对象数，并清零
+size_t take_num_filtered();
 #endif
\ No newline at end of file
@@ -0,0 +1,37 @@
+#ifndef ENCODE_UTILS_H_
+#define ENCODE_UTILS_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "read_utils.h"
+
+std::string get_gdal_image_type(const std::string& file);
+
+// 编码参数沿用 GDAL 创建选项的命名: png 的 ZLEVEL/FILTER/STRATEGY，
+// jpg 的 QUALITY/DCT_METHOD，tif 的 COMPRESS/PREDICTOR/ZLEVEL/ZSTD_LEVEL
+typedef std::map<std::string, std::string> encode_options_t;
+
+// "fast" 用于临时数据，追求吞吐; "small" 追求体积; "default" 为空
+encode_options_t get_encode_preset(const std::string& preset);
+
+// 编码器直接从 patch 缓冲区编码到内存，每个线程一个实例 (get_encoder)，
+// 选项解析和行指针等缓冲区在线程内复用，libpng/libtiff 的写句柄每个 patch 重建
+class encoder {
+ public:
+  virtual ~encoder() {}
+  virtual void encode(const patch_t& patch,
+                      std::vector<unsigned char>& out) = 0;
+};
+
+// 按扩展名 (png/jpg/tif/bmp...) 取得当前线程的编码器，
+// 编译时找到 libpng/libjpeg/libtiff 则直接编码，否则经由 GDAL 驱动
+encoder& get_encoder(const std::string& img_ext,
+                     const encode_options_t& options = encode_options_t());
+
+void write_file(const std::string& file, const std::vector<unsigned char>& data);
+void write_file(const std::string& file, const std::string& data);
+void write_file(const std::string& file, const char* data, const size_t& size);
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef GRID_INDEX_HPP_
+#define GRID_INDEX_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace spatial {
+
+// 均匀网格索引，存放对象的轴对齐外接框，只返回外接框与查询矩形相交的对象
+class grid_index {
+ public:
+  grid_index(const double &x_min, const double &y_min, const double &x_max,
+             const double &y_max, const double &cell_size)
+      : _x_min(x_min), _y_min(y_min), _cell_size(std::max(cell_size, 1.)) {
+    _cols = std::max(1, static_cast<int>(
+                            std::ceil((x_max - x_min) / _cell_size)));
+    _rows = std::max(1, static_cast<int>(
+                            std::ceil((y_max - y_min) / _cell_size)));
+    _cells.resize(static_cast<size_t>(_cols) * _rows);
+  }
+
+  void insert(const size_t &id, const double &x1, const double &y1,
+              const double &x2, const double &y2) {
+    if (_boxes.size() <= id) {
+      _boxes.resize(id + 1);
+    }
+    _boxes[id] = box_t{x1, y1, x2, y2};
+    const int c1 = col(x1), c2 = col(x2), r1 = row(y1), r2 = row(y2);
+    for (int r = r1; r <= r2; r++) {
+      for (int c = c1; c <= c2; c++) {
+        _cells[static_cast<size_t>(r) * _cols + c].push_back(id);
+      }
+    }
+  }
+
+  // 结果按对象下标升序排列。跨多个网格的对象只在包含
+  // (max(x1, qx1), max(y1, qy1)) 的网格中报告一次，查询无需额外状态，可并发调用
+  void query(const double &x1, const double &y1, const double &x2,
+             const double &y2, std::vector<size_t> &res) const {
+    res.clear();
+    const int c1 = col(x1), c2 = col(x2), r1 = row(y1), r2 = row(y2);
+    for (int r = r1; r <= r2; r++) {
+      for (int c = c1; c <= c2; c++) {
+        for (auto &id : _cells[static_cast<size_t>(r) * _cols + c]) {
+          const box_t &b = _boxes[id];
+          if (b.x1 > x2 || b.x2 < x1 || b.y1 > y2 || b.y2 < y1) {
+            continue;
+          }
+          if (col(std::max(b.x1, x1)) != c || row(std::max(b.y1, y1)) != r) {
+            continue;
+          }
+          res.push_back(id);
+        }
+      }
+    }
+    std::sort(res.begin(), res.end());
+  }
+
+ private:
+  typedef struct {
+    double x1, y1, x2, y2;
+  } box_t;
+
+  int col(const double &x) const {
+    const int c = static_cast<int>(std::floor((x - _x_min) / _cell_size));
+    return std::min(std::max(c, 0), _cols - 1);
+  }
+
+  int row(const double &y) const {
+    const int r = static_cast<int>(std::floor((y - _y_min) / _cell_size));
+    return std::min(std::max(r, 0), _rows - 1);
+  }
+
+  double _x_min;
+  double _y_min;
+  double _cell_size;
+  int _cols;
+  int _rows;
+  std::vector<box_t> _boxes;
+  std::vector<std::vector<size_t>> _cells;
+};
+
+} // namespace spatial
+
+#endif
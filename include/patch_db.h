@@ -0,0 +1,61 @@
+#ifndef PATCH_DB_H_
+#define PATCH_DB_H_
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ann_sink.h"
+#include "bounded_queue.hpp"
+
+struct sqlite3;
+
+// output_mode 为 "sqlite" 时的 patch 容器 (类似 MBTiles): 编码后的图像和 DOTA
+// 标注以 BLOB 存入一个 SQLite 数据库，可以按 (image_id, size, x, y) 随机读取:
+//   patches(image_id, size, x, y, width, height, data, ann)
+//   metadata(name, value)
+// 工作线程把记录放入有界队列，由一个专门的写线程按批提交事务。
+// 编译时没有 SQLite3 (WITH_SQLITE3) 则构造时报错
+class patch_db {
+ public:
+  // with_ann 为 false 时 ann 列为 NULL，capacity 为队列中最多的记录数
+  patch_db(const std::string& file, const std::string& img_ext,
+           const bool& with_ann, const int& precision, const size_t& capacity);
+  ~patch_db();
+
+  // size 为原图上的窗口尺寸，(x, y) 为窗口左上角，与 patch 文件名一致。
+  // 可以被多个线程同时调用
+  void write(const std::string& image_id, const size_t& size, const size_t& x,
+             const size_t& y, const std::vector<unsigned char>& data,
+             const patch_ann_t& ann);
+
+  // 所有 patch 写完后调用一次，提交剩余的记录并关闭数据库
+  void close();
+
+ private:
+  typedef struct {
+    std::string image_id;
+    size_t size;
+    size_t x;
+    size_t y;
+    size_t width;
+    size_t height;
+    std::vector<unsigned char> data;
+    std::string ann;
+  } record_t;
+
+  void exec(const char* sql);
+  void run();
+
+  std::string _file;
+  bool _with_ann;
+  int _precision;
+  sqlite3* _db;
+  bounded_queue<std::unique_ptr<record_t>> _records;
+  bounded_queue<std::unique_ptr<record_t>> _free_records; // 复用记录的缓冲区
+  std::thread _writer;
+};
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "dota_utils.h"
+#include "split_utils.h"
+
+// 流水线模式: 遍历目录、解析标注、规划窗口、读取像素、编码写出
+// 五个阶段由有界队列相连，同时进行，返回保存的 patch 数量。
+// 阶段运行在共享线程池上 (至少 4 个线程)，占满所有工作线程直到结束。
+// dirs 为 (img_dir, ann_dir) 对，load_stats/split_stats 为加载和保存的对象数
+size_t pipeline_split(
+    const std::vector<std::pair<std::string, std::string>>& dirs,
+    const split_cfg_t& cfg, const int& nthread, class_stats_t& load_stats,
+    class_stats_t& split_stats);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef PIXEL_DISPATCH_HPP_
+#define PIXEL_DISPATCH_HPP_
+
+#include <gdal.h>
+
+namespace pixel {
+
+// 内核模板 K<T, C> 的波段数: C 为 1/3/4 时是编译期常量，内层循环可以展开和
+// 向量化; C 为 0 时使用运行时传入的波段数
+template <int C>
+struct channels {
+  static int get(const int &) { return C; }
+};
+
+template <>
+struct channels<0> {
+  static int get(const int &nchannels) { return nchannels; }
+};
+
+// 把 K<T, C> 的像素类型固定，得到只以波段数为参数的模板
+template <template <typename, int> class K, typename T>
+struct bind_type {
+  template <int C>
+  using type = K<T, C>;
+};
+
+// 按波段数选择 K<C>::run 的实例，每张图像选择一次，像素循环中不再分支
+template <template <int> class K>
+auto select_channels(const int &nchannels) -> decltype(&K<0>::run) {
+  switch (nchannels) {
+  case 1:
+    return &K<1>::run;
+  case 3:
+    return &K<3>::run;
+  case 4:
+    return &K<4>::run;
+  default:
+    return &K<0>::run;
+  }
+}
+
+// 按数据类型 (uint8/uint16/int16/float32) 和波段数选择 K<T, C>::run，
+// 其它数据类型返回 nullptr，由调用者退回通用实现
+template <template <typename, int> class K>
+auto select(const GDALDataType &data_type, const int &nchannels)
+    -> decltype(&K<unsigned char, 0>::run) {
+  switch (data_type) {
+  case GDT_Byte:
+    return select_channels<bind_type<K, unsigned char>::template type>(
+        nchannels);
+  case GDT_UInt16:
+    return select_channels<bind_type<K, unsigned short>::template type>(
+        nchannels);
+  case GDT_Int16:
+    return select_channels<bind_type<K, short>::template type>(nchannels);
+  case GDT_Float32:
+    return select_channels<bind_type<K, float>::template type>(nchannels);
+  default:
+    return nullptr;
+  }
+}
+
+} // namespace pixel
+
+#endif
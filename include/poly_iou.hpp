@@ -197,6 +197,83 @@ inline T single_poly_iou_rotated(T const *const box1_raw,
   return iou;
 }
 
+template <typename T>
+inline void rect_cut(Point<T> *p, uint8_t &n, Point<T> *pp, const int &axis,
+                     const T &bound, const bool &keep_greater) {
+  auto inside = [&](const Point<T> &q) {
+    const T v = axis == 0 ? q.x : q.y;
+    return keep_greater ? v >= bound : v <= bound;
+  };
+  uint8_t m = 0;
+  for (uint8_t i = 0; i < n; i++) {
+    const Point<T> &a = p[i];
+    const Point<T> &b = p[(i + 1) % n];
+    const bool ia = inside(a), ib = inside(b);
+    if (ia) {
+      pp[m++] = a;
+    }
+    if (ia != ib) {
+      const T va = axis == 0 ? a.x : a.y;
+      const T vb = axis == 0 ? b.x : b.y;
+      const T t = (bound - va) / (vb - va);
+      pp[m++] = axis == 0 ? Point<T>(bound, a.y + (b.y - a.y) * t)
+                          : Point<T>(a.x + (b.x - a.x) * t, bound);
+    }
+  }
+  for (uint8_t i = 0; i < m; i++) {
+    p[i] = pp[i];
+  }
+  n = m;
+}
+
+// 四边形与轴对齐矩形 [x1, x2] x [y1, y2] 的 IoF (交集 / 四边形面积)，
+// 与 single_poly_iou_rotated(poly, rect, kIoF) 的结果一致 (包括自交四边形)。
+// 外接框完全在矩形外或内时直接返回，其余情况对矩形四条边做 Sutherland–Hodgman 裁剪
+template <typename T>
+inline T poly_rect_iof(T const *const poly_raw, const T &x1, const T &y1,
+                       const T &x2, const T &y2) {
+  static_assert(is_same<typename decay<T>::type, float>::value ||
+                    is_same<typename decay<T>::type, double>::value ||
+                    is_same<typename decay<T>::type, long double>::value,
+                "poly must be float or double");
+  Point<T> p[kMaxn];
+  T px1 = poly_raw[0], py1 = poly_raw[1], px2 = poly_raw[0],
+    py2 = poly_raw[1];
+  for (uint8_t i = 0; i < 4; ++i) {
+    p[i].x = poly_raw[i * 2];
+    p[i].y = poly_raw[i * 2 + 1];
+    px1 = p[i].x < px1 ? p[i].x : px1;
+    px2 = p[i].x > px2 ? p[i].x : px2;
+    py1 = p[i].y < py1 ? p[i].y : py1;
+    py2 = p[i].y > py2 ? p[i].y : py2;
+  }
+  // 与 single_poly_iou_rotated 一致，裁剪后的有向面积按四边形自身的朝向取号，
+  // 自交 (蝴蝶形) 四边形的 IoF 可能为负
+  const T signed_area = area<T>(p, 4);
+  const T orientation = signed_area < 0 ? -1 : 1;
+  const T poly_area = fabs(signed_area);
+
+  T inter_area = 0;
+  if (px2 <= x1 || px1 >= x2 || py2 <= y1 || py1 >= y2) {
+    inter_area = 0;
+  } else if (px1 >= x1 && px2 <= x2 && py1 >= y1 && py2 <= y2) {
+    inter_area = poly_area;
+  } else {
+    Point<T> pp[kMaxn];
+    uint8_t n = 4;
+    rect_cut<T>(p, n, pp, 0, x1, true);
+    rect_cut<T>(p, n, pp, 0, x2, false);
+    rect_cut<T>(p, n, pp, 1, y1, true);
+    rect_cut<T>(p, n, pp, 1, y2, false);
+    inter_area = n < 3 ? 0 : orientation * area<T>(p, n);
+  }
+
+  if (poly_area == 0) {
+    return (inter_area + 1) / (poly_area + 1);
+  }
+  return inter_area / poly_area;
+}
+
 } // namespace std
 
 #endif
@@ -0,0 +1,125 @@
+#ifndef READ_UTILS_H_
+#define READ_UTILS_H_
+
+#include <gdal.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+class GDALDataset;
+
+typedef struct {
+  size_t width;
+  size_t height;
+  int nchannels;
+  GDALDataType data_type;
+  size_t data_size;
+  std::vector<unsigned char> data; // pixel-interleaved, row-major
+} patch_t;
+
+// 像素交错缓冲区中的一块区域
+typedef struct {
+  const unsigned char* data; // 左上角像素
+  size_t width;
+  size_t height;
+  size_t line_size; // 行跨度，字节
+} image_view_t;
+
+void init_patch(patch_t& patch, const size_t& width, const size_t& height,
+                const int& nchannels, const GDALDataType& data_type);
+
+// 只填充 patch 中有效区域 [0, x_num) × [0, y_num) 之外的右侧和下方边框，
+// mode 为 "constant" (padding_value 按数据类型转换)、"edge" (复制边缘像素)
+// 或 "reflect" (以边缘像素为轴镜像，不重复边缘)。有效区域覆盖整个 patch 时不写入
+void pad_patch(patch_t& patch, const size_t& x_num, const size_t& y_num,
+               const std::string& mode,
+               const std::vector<float>& padding_value);
+
+// 一次 GDALDataset::RasterIO 读取窗口的所有波段到像素交错的 patch 中
+void read_window(GDALDataset* dataset, const size_t& x_start,
+                 const size_t& y_start, const size_t& x_num,
+                 const size_t& y_num, patch_t& patch);
+
+// 把窗口重采样为 buf_x × buf_y 读取到 patch 左上角，缩小时 GDAL 会使用概览
+void read_window(GDALDataset* dataset, const size_t& x_start,
+                 const size_t& y_start, const size_t& x_num,
+                 const size_t& y_num, patch_t& patch, const size_t& buf_x,
+                 const size_t& buf_y, const GDALRIOResampleAlg& alg);
+
+// "auto" 缩小时取 average，放大时取 bilinear，
+// 其它为 nearest/bilinear/cubic/cubicspline/lanczos/average/mode/gauss
+GDALRIOResampleAlg get_resample_alg(const std::string& name,
+                                    const double& scale);
+
+// 用 DATAPOINTER 把 patch 包装成 MEM 数据集，不拷贝像素
+GDALDataset* wrap_patch(const patch_t& patch);
+
+// 同上，包装任意行跨度的像素交错缓冲区
+GDALDataset* wrap_buffer(const unsigned char* data, const size_t& width,
+                         const size_t& height, const int& nchannels,
+                         const GDALDataType& data_type,
+                         const size_t& line_size);
+
+// 同一图像的多个只读句柄，GDALDataset 不能被多个线程同时读取，
+// 每个线程取用一个句柄，用完放回供其它线程复用
+class dataset_pool {
+ public:
+  explicit dataset_pool(const std::string& file);
+  ~dataset_pool();
+
+  GDALDataset* acquire();
+  void release(GDALDataset* dataset);
+
+ private:
+  std::string _file;
+  std::mutex _lock;
+  std::vector<GDALDataset*> _free;
+  std::vector<GDALDataset*> _all;
+};
+
+// 按数据集的自然块高度读取整行条带，窗口从共享条带中拷贝，保证每个块只解码一次。
+// 窗口必须按 y_start 非递减的顺序读取。
+// pyramid 为 true 时 (仅 uint8/uint16) 在内存中同步维护 2 倍降采样的条带，
+// 所有尺寸和缩放比例的窗口共享同一次解码
+class block_reader {
+ public:
+  explicit block_reader(GDALDataset* dataset, const bool& pyramid = false);
+
+  void read(const size_t& x_start, const size_t& y_start, const size_t& x_num,
+            const size_t& y_num, patch_t& patch);
+
+  // 条带中原图区域对应的像素。level 为 1 时返回降采样层上的区域，
+  // 其坐标为原图坐标的一半，起点向下取整、终点向上取整。只有起点和尺寸
+  // 都是偶数时它才与原图区域严格对齐
+  image_view_t view(const size_t& x_start, const size_t& y_start,
+                    const size_t& x_num, const size_t& y_num,
+                    const int& level = 0);
+
+  bool has_pyramid() const { return _pyramid; }
+
+ private:
+  void advance(const size_t& y_start, const size_t& y_stop);
+  void advance_half(const size_t& y_start, const size_t& y_stop);
+
+  GDALDataset* _dataset;
+  size_t _width;
+  size_t _height;
+  int _nchannels;
+  GDALDataType _data_type;
+  size_t _pixel_size;
+  size_t _block_height;
+  size_t _row_start;
+  size_t _row_stop;
+  std::vector<unsigned char> _strip;
+  bool _pyramid;
+  size_t _half_width;
+  size_t _half_start;
+  size_t _half_stop;
+  std::vector<unsigned char> _half;
+  // 按数据类型和波段数选择的降采样内核
+  void (*_downsample)(const unsigned char*, const unsigned char*,
+                      const size_t&, const int&, unsigned char*);
+};
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef RECT_IOF_H_
+#define RECT_IOF_H_
+
+#include <cstddef>
+
+// 结构数组 (SoA) 形式的四边形，x[k][i]、y[k][i] 为第 i 个对象的第 k 个顶点
+typedef struct {
+  const double* x[4];
+  const double* y[4];
+  size_t size;
+} quads_t;
+
+// 批量计算四边形与轴对齐窗口 [x1, x2] x [y1, y2] 的 IoF，
+// 结果与 std::single_poly_iou_rotated(quad, window, std::kIoF) 在误差范围内一致。
+// 按 cpu::simd_level() 选择 AVX2 (4 个对象/次)、SSE2 (2 个对象/次) 或标量实现
+void rect_iof_batch(const quads_t& quads, const double& x1, const double& y1,
+                    const double& x2, const double& y2, double* iofs);
+
+// 各指令集的实现，供 rect_iof_batch 分派
+void rect_iof_batch_scalar(const quads_t& quads, const size_t& begin,
+                           const double& x1, const double& y1,
+                           const double& x2, const double& y2, double* iofs);
+void rect_iof_batch_sse2(const quads_t& quads, const size_t& begin,
+                         const double& x1, const double& y1, const double& x2,
+                         const double& y2, double* iofs);
+void rect_iof_batch_avx2(const quads_t& quads, const size_t& begin,
+                         const double& x1, const double& y1, const double& x2,
+                         const double& y2, double* iofs);
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef RECT_IOF_KERNEL_HPP_
+#define RECT_IOF_KERNEL_HPP_
+
+#include <cstddef>
+
+#include "rect_iof.h"
+
+// 与 rect_iof_batch 配套的无分支内核，V 为向量类型的封装 (见各实现文件)，
+// 需提供 set1/load/store/add/sub/mul/div/min/max/abs/eq/gt/select。
+// 只包含模板，避免不同指令集编译的翻译单元之间产生同名的内联函数。
+//
+// 交集面积按扫描线积分: 对多边形每条有向边 a->b，
+// 累加 sign(dy) * ∫ (clamp(x(y), x1, x2) - x1) dy，y 限制在 [y1, y2] 内。
+// 被积函数在 x(y) 穿过 x1、x2 处分段线性，按两个折点分三段用梯形公式精确求积
+namespace rect_iof {
+
+template <typename V>
+inline typename V::type clamp(const typename V::type &v,
+                              const typename V::type &lo,
+                              const typename V::type &hi) {
+  return V::min(V::max(v, lo), hi);
+}
+
+template <typename V>
+inline typename V::type
+edge_integral(const typename V::type &xa, const typename V::type &ya,
+              const typename V::type &xb, const typename V::type &yb,
+              const typename V::type &x1, const typename V::type &y1,
+              const typename V::type &x2, const typename V::type &y2) {
+  typedef typename V::type T;
+  const T zero = V::set1(0.);
+  const T ca = clamp<V>(ya, y1, y2);
+  const T cb = clamp<V>(yb, y1, y2);
+  const T lo = V::min(ca, cb);
+  const T hi = V::max(ca, cb);
+  const T dx = V::sub(xb, xa);
+  const T dy = V::sub(yb, ya);
+  const T dx_zero = V::eq(dx, zero);
+  const T slope = V::select(V::eq(dy, zero), zero, V::div(dx, dy));
+  const T inv = V::select(dx_zero, zero, V::div(dy, dx));
+
+  // y 方向上 x(y) 穿过 x1、x2 的位置
+  T b1 = V::select(dx_zero, lo, V::add(ya, V::mul(V::sub(x1, xa), inv)));
+  T b2 = V::select(dx_zero, lo, V::add(ya, V::mul(V::sub(x2, xa), inv)));
+  b1 = clamp<V>(b1, lo, hi);
+  b2 = clamp<V>(b2, lo, hi);
+  const T t1 = V::min(b1, b2);
+  const T t2 = V::max(b1, b2);
+
+  auto g = [&](const T &y) {
+    return V::sub(clamp<V>(V::add(xa, V::mul(V::sub(y, ya), slope)), x1, x2),
+                  x1);
+  };
+  const T g_lo = g(lo), g_t1 = g(t1), g_t2 = g(t2), g_hi = g(hi);
+  T res = V::mul(V::add(g_lo, g_t1), V::sub(t1, lo));
+  res = V::add(res, V::mul(V::add(g_t1, g_t2), V::sub(t2, t1)));
+  res = V::add(res, V::mul(V::add(g_t2, g_hi), V::sub(hi, t2)));
+  res = V::mul(res, V::set1(0.5));
+  return V::select(V::gt(cb, ca), res, V::sub(zero, res));
+}
+
+template <typename V>
+inline size_t batch(const quads_t &quads, const size_t &begin,
+                    const double &wx1, const double &wy1, const double &wx2,
+                    const double &wy2, double *iofs) {
+  typedef typename V::type T;
+  const T x1 = V::set1(wx1), y1 = V::set1(wy1);
+  const T x2 = V::set1(wx2), y2 = V::set1(wy2);
+  const T zero = V::set1(0.), one = V::set1(1.), half = V::set1(0.5);
+  size_t i = begin;
+  for (; i + V::width <= quads.size; i += V::width) {
+    T x[4], y[4];
+    for (int k = 0; k < 4; k++) {
+      x[k] = V::load(quads.x[k] + i);
+      y[k] = V::load(quads.y[k] + i);
+    }
+    T inter = zero, area = zero;
+    for (int k = 0; k < 4; k++) {
+      const int l = (k + 1) % 4;
+      inter = V::add(inter,
+                     edge_integral<V>(x[k], y[k], x[l], y[l], x1, y1, x2, y2));
+      area = V::add(area, V::sub(V::mul(x[k], y[l]), V::mul(x[l], y[k])));
+    }
+    // 与 single_poly_iou_rotated 一致，交集按多边形自身的朝向取号: 自交
+    // (蝴蝶形) 四边形的 IoF 可能为负，不能取绝对值
+    inter = V::select(V::gt(zero, area), V::sub(zero, inter), inter);
+    area = V::mul(V::abs(area), half);
+    // 面积为 0 时与 single_poly_iou_rotated 一致，取 (inter + 1) / (0 + 1)
+    const T iof = V::select(V::eq(area, zero), V::add(inter, one),
+                            V::div(inter, area));
+    V::store(iofs + i, iof);
+  }
+  return i;
+}
+
+} // namespace rect_iof
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef RESAMPLE_H_
+#define RESAMPLE_H_
+
+#include <gdal.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// 可分离重采样的一维权重: 输出坐标 i 使用源坐标 [start[i], start[i] + taps)，
+// 权重为 weights[i * taps, (i + 1) * taps)
+typedef struct {
+  std::vector<int> start;
+  std::vector<float> weights;
+  int taps;
+} resample_taps_t;
+
+// 面积平均: 输出像素取其覆盖的源像素按覆盖长度加权的平均，用于缩小
+resample_taps_t area_taps(const size_t& src_size, const size_t& dst_size);
+
+// 双线性: 像素中心对齐，边界处截断，用于放大
+resample_taps_t bilinear_taps(const size_t& src_size, const size_t& dst_size);
+
+// 像素交错的 uint8/uint16 图像重采样，src_w × src_h 缩放到 dst_w × dst_h，
+// stride 以元素计。method 为 "average"、"bilinear" 或 "auto" (缩小 average，放大 bilinear)。
+// 先按行加权累加 (按 cpu::simd_level() 分派)，再在行内按列加权
+void resample_image(const void* src, const size_t& src_w, const size_t& src_h,
+                    const size_t& src_stride, void* dst, const size_t& dst_w,
+                    const size_t& dst_h, const size_t& dst_stride,
+                    const int& nchannels, const GDALDataType& data_type,
+                    const std::string& method);
+
+// resample_image 支持的数据类型和方法
+bool resample_supported(const GDALDataType& data_type,
+                        const std::string& method);
+
+// 各指令集的实现: acc[i] += w * row[i]，i < n，结果与标量版本逐位一致
+void accumulate_row_u8_scalar(const unsigned char* row, const float& w,
+                              float* acc, const size_t& n);
+void accumulate_row_u16_scalar(const unsigned short* row, const float& w,
+                               float* acc, const size_t& n);
+void accumulate_row_u8_sse2(const unsigned char* row, const float& w,
+                            float* acc, const size_t& n);
+void accumulate_row_u16_sse2(const unsigned short* row, const float& w,
+                             float* acc, const size_t& n);
+void accumulate_row_u8_avx2(const unsigned char* row, const float& w,
+                            float* acc, const size_t& n);
+void accumulate_row_u16_avx2(const unsigned short* row, const float& w,
+                             float* acc, const size_t& n);
+
+#endif
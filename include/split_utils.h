@@ -1,19 +1,88 @@
 #ifndef SPLIT_UTILS_H_
 #define SPLIT_UTILS_H_
 
+#include <memory>
 #include <mutex>
 #include <string>
 #include <vector>
 
+#include "ann_sink.h"
+#include "bit_depth.h"
 #include "dota_utils.h"
+#include "encode_utils.h"
+#include "patch_db.h"
+#include "tar_writer.h"
 
+typedef struct {
+  std::vector<int> sizes; // 原图上的窗口尺寸，即 size / rate
+  std::vector<int> gaps;
+  std::vector<int> out_sizes; // rescale 时每个窗口尺寸对应的输出尺寸
+  bool rescale;
+  std::string resample; // rescale 时的重采样方式
+  std::string resample_engine; // "gdal" 或 "builtin" (uint8/uint16 的 SIMD 内核)
+  float img_rate_thr;
+  float iof_thr;
+  std::string iof_kernel; // "batch", "aabb" or "general"
+  bool no_padding;
+  std::vector<float> padding_value;
+  std::string padding_mode; // "constant", "edge" or "reflect"
+  std::string to_8bit; // "none", "minmax" or "percentile"
+  std::vector<double> stretch_percent; // percentile 的上下分位数
+  double gamma;
+  std::string save_dir;
+  std::shared_ptr<tar_output> tar; // 不为空时 patch 写入 tar 分片而不是单独的文件
+  std::shared_ptr<patch_db> db; // 不为空时 patch 和 dota 标注写入 SQLite 数据库
+  std::vector<std::shared_ptr<ann_sink>> ann_sinks; // 为空时不写标注
+  std::string img_ext;
+  encode_options_t save_options;
+  float ignore_empty_prob;
+  std::string read_mode; // "window", "block" or "auto"
+  bool pyramid; // rescale 块读取时维护 2 倍降采样层
+  bool window_parallel;  // 同一图像的窗口分段并行处理
+} split_cfg_t;
+
+// 一个待保存的窗口，坐标为原图坐标，x_stop/y_stop 可能超出图像。
+// scale 为输出像素与原图像素之比，图像和标注都按它缩放
+typedef struct {
+  size_t x_start;
+  size_t y_start;
+  size_t x_stop;
+  size_t y_stop;
+  double scale;
+  window_ann_t ann;
+} window_t;
+
+// 是否用 block_reader 读取: read_mode 为 "auto" 时同时存在的 num_strips 个
+// 条带的总内存不超过上限即使用
+bool use_block_reader(const content_t& info, const split_cfg_t& cfg,
+                      const size_t& num_strips = 1);
+
+// 估计单张图像的处理代价 (相对单位): 解码读取的像素字节数按压缩方式加权，
+// 加上编码写出的像素字节数，用于让代价大的图像先开始
+double estimate_cost(const content_t& info, const split_cfg_t& cfg);
+
+// 生成滑窗、匹配对象、按 ignore_empty_prob 丢弃空窗口，返回读取顺序的窗口
+std::vector<window_t> plan_windows(const content_t& info,
+                                   const split_cfg_t& cfg);
+
+// to_8bit 不为 "none" 时按整张图像的统计建立转换器，否则返回空
+std::unique_ptr<depth_converter> make_depth_converter(GDALDataset* dataset,
+                                                      const split_cfg_t& cfg);
+
+// reader 为空时按窗口直接读取，converter 不为空时在填充前转换为 8 位
+void read_patch(const content_t& info, const window_t& window,
+                const split_cfg_t& cfg, GDALDataset* dataset,
+                block_reader* reader, patch_t& patch,
+                const depth_converter* converter = nullptr);
+
+// 编码并写出图像和标注，保存的对象计入 stats
+void save_patch(const content_t& info, const window_t& window,
+                const patch_t& patch, const split_cfg_t& cfg, encoder& enc,
+                std::vector<unsigned char>& encoded, class_stats_t& stats);
+
+// prog 和 stats 在 lock 保护下累加
 size_t single_split(const std::pair<content_t, std::string>& arguments,
-                    const std::vector<int>& sizes, const std::vector<int>& gaps,
-                    const float& img_rate_thr, const float& iof_thr,
-                    const bool& no_padding,
-                    const std::vector<float>& padding_value,
-                    const std::string& save_dir, const std::string& anno_dir,
-                    const std::string& img_ext, const float& ignore_empty_prob,
-                    const size_t& total, size_t& prog, std::mutex& lock);
-
-#endif
\ No newline at end of file
+                    const split_cfg_t& cfg, const size_t& total, size_t& prog,
+                    class_stats_t& stats, std::mutex& lock);
+
+#endif
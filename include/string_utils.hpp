@@ -2,6 +2,7 @@
 #define STRING_UTILS_HPP_
 
 #include <algorithm>
+#include <cmath>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -31,6 +32,58 @@ inline std::string tolower(const std::string &line) {
   return new_line;
 }
 
+inline std::string toupper(const std::string &line) {
+  std::string new_line;
+  new_line.reserve(line.size());
+  std::transform(line.begin(), line.end(), std::back_inserter(new_line),
+                 ::toupper);
+  return new_line;
+}
+
+// 把整数的十进制表示追加到 out，不经过 to_string 的临时字符串
+inline void append_int(std::string &out, const long long &value) {
+  char buf[24];
+  char *p = buf + sizeof(buf);
+  unsigned long long v = value < 0 ? 0ULL - value : value;
+  do {
+    *--p = static_cast<char>('0' + v % 10);
+    v /= 10;
+  } while (v != 0);
+  if (value < 0) {
+    *--p = '-';
+  }
+  out.append(p, buf + sizeof(buf) - p);
+}
+
+// 按 precision 位小数 (四舍五入) 追加定点数，precision 为 0 时截断为整数。
+// 舍入后为 0 的负数不输出负号
+inline void append_fixed(std::string &out, const double &value,
+                         const int &precision) {
+  if (precision <= 0) {
+    append_int(out, static_cast<long long>(value));
+    return;
+  }
+  long long scale = 1;
+  for (int i = 0; i < precision; i++) {
+    scale *= 10;
+  }
+  const long long scaled = std::llround(value * scale);
+  if (scaled < 0) {
+    out.push_back('-');
+  }
+  const unsigned long long abs_scaled =
+      scaled < 0 ? 0ULL - scaled : static_cast<unsigned long long>(scaled);
+  append_int(out, static_cast<long long>(abs_scaled / scale));
+  out.push_back('.');
+  char frac[20];
+  unsigned long long f = abs_scaled % scale;
+  for (int i = precision - 1; i >= 0; i--) {
+    frac[i] = static_cast<char>('0' + f % 10);
+    f /= 10;
+  }
+  out.append(frac, precision);
+}
+
 } // namespace str
 
 #endif
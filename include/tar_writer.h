@@ -0,0 +1,67 @@
+#ifndef TAR_WRITER_H_
+#define TAR_WRITER_H_
+
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// 顺序写入一个线程的 tar 分片 (WebDataset 格式: 同一 patch 的成员共用文件名主干)。
+// 每个分片 <prefix>-<seq>.tar 旁有一个 .idx 文件，每行为 "成员名 数据偏移 大小"
+class tar_writer {
+ public:
+  tar_writer(const std::string& prefix, const size_t& max_size,
+             const size_t& max_count);
+  ~tar_writer();
+
+  // 开始一个新的 patch，当前分片超过大小或数量上限时换到下一个分片，
+  // 同一 patch 的成员总在同一个分片中
+  void begin_sample();
+
+  void add(const std::string& name, const char* data, const size_t& size);
+
+  // 写出 tar 结尾并关闭当前分片
+  void close();
+
+ private:
+  void open_shard();
+  void write_header(const std::string& name, const size_t& size,
+                    const char& type);
+  void write_padded(const char* data, const size_t& size);
+
+  std::string _prefix;
+  size_t _max_size;
+  size_t _max_count;
+  size_t _seq;
+  FILE* _tar;
+  FILE* _index;
+  std::string _tar_file;
+  size_t _offset; // 当前分片已写入的字节数
+  size_t _count;  // 当前分片中的 patch 数
+};
+
+// output_mode 为 "tar" 时所有 patch 的输出: 每个线程第一次使用时得到自己的
+// tar_writer，之后写入不需要加锁
+class tar_output {
+ public:
+  // dir 下的分片命名为 shard-<线程序号>-<分片序号>.tar，
+  // max_size 为字节数、max_count 为 patch 数，0 表示不限
+  tar_output(const std::string& dir, const size_t& max_size,
+             const size_t& max_count);
+
+  tar_writer& writer();
+
+  // 所有线程写完后调用一次
+  void close();
+
+ private:
+  std::string _dir;
+  size_t _max_size;
+  size_t _max_count;
+  std::mutex _lock; // 只保护 _writers 的注册
+  std::vector<std::unique_ptr<tar_writer>> _writers;
+};
+
+#endif
@@ -2,45 +2,66 @@
 #define THREAD_POOL_H_
 
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <functional>
 #include <future>
 #include <list>
-#include <queue>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
+#include <thread>
 #include <vector>
 
 namespace std {
-#define THREADPOOL_MAX_NUM 16
-//#define  THREADPOOL_AUTO_GROW
 
+// 工作窃取线程池: 每个线程一个双端队列，线程内提交的任务放入自己队列的尾部并
+// 从尾部取 (后进先出，利于缓存)，空闲时从外部提交队列的头部取任务，
+// 再从其它线程队列的头部窃取。外部提交的任务按先进先出执行。
 class threadpool {
-  unsigned short _initSize;       //初始化线程数量
   using Task = function<void()>;  //定义类型
-  vector<thread> _pool;           //线程池
-  queue<Task> _tasks;             //任务队列
-  mutex _lock;                    //任务队列同步锁
-#ifdef THREADPOOL_AUTO_GROW
-  mutex _lockGrow;              //线程池增长同步锁
-#endif                          // !THREADPOOL_AUTO_GROW
-  condition_variable _task_cv;  //条件阻塞
-  atomic<bool> _run{true};      //线程池是否执行
-  atomic<int> _idlThrNum{0};    //空闲线程数量
+  struct task_queue {
+    mutex lock;
+    deque<Task> tasks;
+  };
+  vector<unique_ptr<task_queue>> _queues;  // 每个线程一个队列，最后一个为外部提交队列
+  vector<thread> _pool;                    //线程池
+  mutex _lock;                             // 只用于休眠和唤醒
+  condition_variable _task_cv;             //条件阻塞
+  atomic<bool> _run{true};                 //线程池是否执行
+  atomic<size_t> _pending{0};              // 所有队列中的任务数
+  atomic<int> _idlThrNum{0};               //空闲线程数量
 
  public:
-  inline threadpool(unsigned short size = 4) {
-    _initSize = size;
+  inline threadpool(unsigned int size = 4) {
+    if (size == 0) {
+      size = max(thread::hardware_concurrency(), 1U);
+    }
+    for (unsigned int i = 0; i <= size; i++) {
+      _queues.emplace_back(new task_queue);
+    }
     addThread(size);
   }
   inline ~threadpool() {
     _run = false;
+    {
+      lock_guard<mutex> lock{_lock};
+    }
     _task_cv.notify_all();  // 唤醒所有线程执行
     for (thread& thread : _pool) {
-      // thread.detach(); // 让线程“自生自灭”
       if (thread.joinable())
         thread.join();  // 等待任务结束， 前提：线程一定会执行完
     }
   }
 
+  // 进程内共享的线程池，第一次调用时按 size (0 为 CPU 核数) 创建
+  static threadpool& instance(const unsigned int& size = 0) {
+    static threadpool pool(size);
+    return pool;
+  }
+
  public:
   template <class F, class... Args>
   auto commit(F&& f, Args&&... args) -> future<decltype(f(args...))> {
@@ -53,19 +74,7 @@ class threadpool {
     auto task = make_shared<packaged_task<RetType()>>(std::bind(
         forward<F>(f), forward<Args>(args)...));  // 把函数入口及参数,打包(绑定)
     future<RetType> future = task->get_future();
-    {  // 添加任务到队列
-      lock_guard<mutex> lock{
-          _lock};  //对当前块的语句加锁  lock_guard 是 mutex 的 stack
-                   //封装类，构造的时候 lock()，析构的时候 unlock()
-      _tasks.emplace([task]() {  // push(Task{...}) 放到队列后面
-        (*task)();
-      });
-    }
-#ifdef THREADPOOL_AUTO_GROW
-    if (_idlThrNum < 1 && _pool.size() < THREADPOOL_MAX_NUM) addThread(1);
-#endif                      // !THREADPOOL_AUTO_GROW
-    _task_cv.notify_one();  // 唤醒一个线程执行
-
+    push([task]() { (*task)(); });
     return future;
   }
   template <class F, class Container>
@@ -88,68 +97,205 @@ class threadpool {
   template <class F>
   void commit2(F&& task) {
     if (!_run) return;
-    {
-      lock_guard<mutex> lock{_lock};
-      _tasks.emplace(std::forward<F>(task));
+    push(Task(std::forward<F>(task)));
+  }
+  // 把下标区间 [begin, end) 按 grain 分块，调用线程和工作线程通过原子下标动态领取，
+  // 不为每个元素分配 future。对每个下标调用 fn(i)，全部完成后返回
+  template <class F>
+  void parallel_for(const size_t& begin, const size_t& end, const size_t& grain,
+                    F&& fn) {
+    run_chunks(begin, end, grain,
+               [&fn](const size_t&, const size_t& b, const size_t& e) {
+                 for (size_t i = b; i < e; i++) {
+                   fn(i);
+                 }
+               });
+  }
+  // 每个执行者先在本地用 reduce 累加 fn(i)，最后按执行者顺序合并
+  template <class T, class F, class R>
+  T parallel_reduce(const size_t& begin, const size_t& end, const size_t& grain,
+                    const T& identity, F&& fn, R&& reduce) {
+    vector<T> partial(_pool.size() + 1, identity);
+    run_chunks(begin, end, grain,
+               [&fn, &reduce, &partial](const size_t& runner, const size_t& b,
+                                        const size_t& e) {
+                 T& acc = partial[runner];
+                 for (size_t i = b; i < e; i++) {
+                   acc = reduce(acc, fn(i));
+                 }
+               });
+    T res = identity;
+    for (auto& acc : partial) {
+      res = reduce(res, acc);
+    }
+    return res;
+  }
+  // 等待 future 就绪，期间执行队列中的任务，工作线程等待子任务时不会死锁
+  template <class T>
+  T wait(future<T>& f) {
+    while (f.wait_for(chrono::seconds(0)) != future_status::ready) {
+      if (!run_pending_task()) {
+        f.wait_for(chrono::microseconds(100));
+      }
     }
-#ifdef THREADPOOL_AUTO_GROW
-    if (_idlThrNum < 1 && _pool.size() < THREADPOOL_MAX_NUM) addThread(1);
-#endif  // !THREADPOOL_AUTO_GROW
-    _task_cv.notify_one();
+    return f.get();
+  }
+  // 在当前线程执行一个排队的任务，没有任务时返回 false
+  bool run_pending_task() {
+    Task task;
+    if (!pop(current_pool() == this ? current_index() : -1, task)) {
+      return false;
+    }
+    task();
+    return true;
   }
   //空闲线程数量
   int idlCount() { return _idlThrNum; }
   //线程数量
   int thrCount() { return _pool.size(); }
 
-#ifndef THREADPOOL_AUTO_GROW
  private:
-#endif  // !THREADPOOL_AUTO_GROW
-        //添加指定数量的线程
-  void addThread(unsigned short size) {
-#ifdef THREADPOOL_AUTO_GROW
-    if (!_run)  // stoped ??
-      throw runtime_error("Grow on ThreadPool is stopped.");
-    unique_lock<mutex> lockGrow{_lockGrow};  //自动增长锁
-#endif                                       // !THREADPOOL_AUTO_GROW
-    for (; _pool.size() < THREADPOOL_MAX_NUM && size > 0;
-         --size) {  //增加线程数量,但不超过 预定义数量 THREADPOOL_MAX_NUM
-      _pool.emplace_back([this] {  //工作线程函数
-        while (true)  //防止 _run==false 时立即结束,此时任务队列可能不为空
-        {
-          Task task;  // 获取一个待执行的 task
-          {
-            // unique_lock 相比 lock_guard 的好处是：可以随时 unlock() 和 lock()
-            unique_lock<mutex> lock{_lock};
-            _task_cv.wait(lock, [this] {  // wait 直到有 task, 或需要停止
-              return !_run || !_tasks.empty();
-            });
-            if (!_run && _tasks.empty()) return;
+  static threadpool*& current_pool() {
+    static thread_local threadpool* pool = nullptr;
+    return pool;
+  }
+  static int& current_index() {
+    static thread_local int index = -1;
+    return index;
+  }
+
+  // 最多启动 线程数 + 1 个执行者 (含调用线程)，fn(runner, b, e) 处理一个块。
+  // 调用线程领完块后撤销还没开始的执行者任务，只等待已经在执行本次块的线程，
+  // 不在等待期间执行队列中无关的任务。第一个异常在所有执行者结束后重新抛出
+  template <class F>
+  void run_chunks(const size_t& begin, const size_t& end, size_t grain,
+                  const F& fn) {
+    if (begin >= end) {
+      return;
+    }
+    // 排队的执行者任务可能在本函数返回后才被取出，共享状态放在堆上
+    struct chunk_state {
+      atomic<size_t> next{0};
+      atomic<size_t> unclaimed{0};  // 尚未开始的执行者数
+      size_t running = 0;           // 由 lock 保护
+      mutex lock;
+      condition_variable done_cv;
+      exception_ptr error;
+    };
+    grain = max<size_t>(grain, 1);
+    const size_t num_chunks = (end - begin + grain - 1) / grain;
+    const size_t num_runners = min(num_chunks, _pool.size() + 1);
+    auto state = make_shared<chunk_state>();
+    state->unclaimed = num_runners - 1;
+    state->running = num_runners;
+    auto run = [&fn, &begin, &end, &grain, &num_chunks,
+                &state](const size_t& runner) {
+      size_t chunk;
+      while ((chunk = state->next++) < num_chunks) {
+        const size_t b = begin + chunk * grain;
+        try {
+          fn(runner, b, min(end, b + grain));
+        } catch (...) {
+          lock_guard<mutex> lg{state->lock};
+          if (!state->error) state->error = current_exception();
+          state->next = num_chunks;
+        }
+      }
+      lock_guard<mutex> lg{state->lock};
+      if (--state->running == 0) state->done_cv.notify_all();
+    };
+    for (size_t runner = 1; runner < num_runners; runner++) {
+      push([state, &run, runner]() {
+        // 只有领到名额的任务才访问调用线程栈上的 run
+        size_t n = state->unclaimed.load();
+        while (n > 0 && !state->unclaimed.compare_exchange_weak(n, n - 1)) {
+        }
+        if (n > 0) run(runner);
+      });
+    }
+    run(0);
+    unique_lock<mutex> ul{state->lock};
+    state->running -= state->unclaimed.exchange(0);
+    state->done_cv.wait(ul, [&state] { return state->running == 0; });
+    if (state->error) rethrow_exception(state->error);
+  }
+
+  void push(Task&& task) {
+    const size_t i = current_pool() == this
+                         ? static_cast<size_t>(current_index())
+                         : _queues.size() - 1;
+    {
+      // 先计数再发布，窃取者的 _pending-- 不会早于这里而使计数回绕
+      lock_guard<mutex> lock{_queues[i]->lock};
+      _pending++;
+      _queues[i]->tasks.push_back(move(task));
+    }
+    {
+      lock_guard<mutex> lock{_lock};  // 与休眠前的检查互斥，避免丢失唤醒
+    }
+    _task_cv.notify_one();  // 唤醒一个线程执行
+  }
+
+  // index 为当前线程的队列，外部线程为 -1
+  bool pop(const int& index, Task& task) {
+    const int num_queues = static_cast<int>(_queues.size());
+    const int inject = num_queues - 1;
+    if (index >= 0) {
+      auto& q = *_queues[index];
+      lock_guard<mutex> lock{q.lock};
+      if (!q.tasks.empty()) {
+        task = move(q.tasks.back());
+        q.tasks.pop_back();
+        _pending--;
+        return true;
+      }
+    }
+    for (int k = 0; k < num_queues; k++) {
+      // 先取外部提交队列，再从下一个线程开始依次窃取
+      const int i = k == 0 ? inject : (index + k) % inject;
+      if (i == index) {
+        continue;
+      }
+      auto& q = *_queues[i];
+      lock_guard<mutex> lock{q.lock};
+      if (!q.tasks.empty()) {
+        task = move(q.tasks.front());
+        q.tasks.pop_front();
+        _pending--;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  //添加指定数量的线程
+  void addThread(const unsigned int& size) {
+    for (unsigned int n = 0; n < size; n++) {
+      const int index = static_cast<int>(_pool.size());
+      _idlThrNum++;
+      _pool.emplace_back([this, index] {  //工作线程函数
+        current_pool() = this;
+        current_index() = index;
+        while (true) {
+          Task task;
+          if (pop(index, task)) {
             _idlThrNum--;
-            task = move(_tasks.front());  // 按先进先出从队列取一个 task
-            _tasks.pop();
-          }
-          task();  //执行任务
-#ifdef THREADPOOL_AUTO_GROW
-          if (_idlThrNum > 0 &&
-              _pool.size() >
-                  _initSize)  //支持自动释放空闲线程,避免峰值过后大量空闲线程
-            return;
-#endif  // !THREADPOOL_AUTO_GROW
-          {
-            unique_lock<mutex> lock{_lock};
+            task();  //执行任务
             _idlThrNum++;
+            continue;
           }
+          unique_lock<mutex> lock{_lock};
+          _task_cv.wait(lock, [this] {  // wait 直到有 task, 或需要停止
+            return !_run || _pending > 0;
+          });
+          //防止 _run==false 时立即结束,此时任务队列可能不为空
+          if (!_run && _pending == 0) return;
         }
       });
-      {
-        unique_lock<mutex> lock{_lock};
-        _idlThrNum++;
-      }
     }
   }
 };
 
 }  // namespace std
 
-#endif  // https://github.com/lzpong/
\ No newline at end of file
+#endif  // https://github.com/lzpong/
@@ -0,0 +1,281 @@
+#include "ann_sink.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+#include "dota_utils.h"
+#include "encode_utils.h"
+#include "loguru.hpp"
+#include "string_utils.hpp"
+
+using std::string;
+using std::vector;
+
+// 流式写出的文件缓冲区大小
+static const size_t kWriteBufferSize = 1 << 20;
+
+// 追加带引号的 JSON 字符串
+static void append_json_string(string &out, const string &value) {
+  out.push_back('"');
+  for (auto &c : value) {
+    if (c == '"' || c == '\\') {
+      out.push_back('\\');
+      out.push_back(c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      out += buf;
+    } else {
+      out.push_back(c);
+    }
+  }
+  out.push_back('"');
+}
+
+static void append_coords(string &out, const double *coords, const int &n,
+                          const int &precision) {
+  for (int k = 0; k < n; k++) {
+    if (k > 0) {
+      out.push_back(',');
+    }
+    str::append_fixed(out, coords[k], precision);
+  }
+}
+
+void append_dota_ann(string &out, const patch_ann_t &ann,
+                     const int &precision) {
+  auto &dict = class_dict::instance();
+  for (size_t j = 0; j < ann.labels.size(); j++) {
+    for (int k = 0; k < 8; k++) {
+      str::append_fixed(out, ann.bboxes[8 * j + k], precision);
+      out.push_back(' ');
+    }
+    out += dict.name(ann.labels[j]);
+    out.push_back(' ');
+    out.push_back(!ann.trunc[j] ? ann.diffs[j] + '0' : '2');
+    if (j < ann.labels.size() - 1) {
+      out.push_back('\n');
+    }
+  }
+}
+
+// 每个 patch 一个 DOTA 格式的 txt 文件
+class dota_sink : public ann_sink {
+ public:
+  dota_sink(const string &dir, const int &precision, tar_output *tar)
+      : _dir(dir), _precision(precision), _tar(tar) {}
+
+  void write(const patch_ann_t &ann) override {
+    static thread_local string lines;
+    lines.clear();
+    append_dota_ann(lines, ann, _precision);
+    if (_tar != nullptr) {
+      _tar->writer().add(ann.id + ".txt", lines.data(), lines.size());
+    } else {
+      write_file(_dir + ann.id + ".txt", lines);
+    }
+  }
+
+ private:
+  string _dir;
+  int _precision;
+  tar_output *_tar;
+};
+
+// 单个文件的流式输出，各线程在锁外格式化，锁内只做一次 fwrite
+class stream_file {
+ public:
+  explicit stream_file(const string &file) : _file(file), _num_items(0) {
+    _fp = fopen(file.c_str(), "wb");
+    CHECK_F(_fp != nullptr, "fopen %s: %s", file.c_str(), strerror(errno));
+    setvbuf(_fp, nullptr, _IOFBF, kWriteBufferSize);
+  }
+  ~stream_file() { close(); }
+
+  // list_item 为 true 时 data 是 JSON 数组中的元素，按写入顺序加分隔符
+  void append(const string &data, const bool &list_item = false) {
+    std::lock_guard<std::mutex> lg(_lock);
+    if (list_item) {
+      fputs(_num_items++ > 0 ? ",\n" : "\n", _fp);
+    }
+    size_t n = fwrite(data.data(), 1, data.size(), _fp);
+    CHECK_F(n == data.size(), "fwrite %s: %s", _file.c_str(), strerror(errno));
+  }
+
+  // 调用者保证此时没有其它线程写入
+  FILE *handle() { return _fp; }
+
+  void close() {
+    if (_fp != nullptr) {
+      CHECK_F(fclose(_fp) == 0, "fclose %s: %s", _file.c_str(),
+              strerror(errno));
+      _fp = nullptr;
+    }
+  }
+
+ private:
+  string _file;
+  FILE *_fp;
+  size_t _num_items;
+  std::mutex _lock;
+};
+
+// 每个 patch 一行:
+// {"id":..., "file_name":..., "width":..., "height":...,
+//  "objects":[{"poly":[8 个坐标], "label":..., "difficult":..., "truncated":...}]}
+class jsonl_sink : public ann_sink {
+ public:
+  jsonl_sink(const string &file, const int &precision)
+      : _out(file), _precision(precision) {}
+
+  void write(const patch_ann_t &ann) override {
+    auto &dict = class_dict::instance();
+    static thread_local string line;
+    line.assign("{\"id\":");
+    append_json_string(line, ann.id);
+    line += ",\"file_name\":";
+    append_json_string(line, ann.file_name);
+    line += ",\"width\":";
+    str::append_int(line, ann.width);
+    line += ",\"height\":";
+    str::append_int(line, ann.height);
+    line += ",\"objects\":[";
+    for (size_t j = 0; j < ann.labels.size(); j++) {
+      line += j == 0 ? "{\"poly\":[" : ",{\"poly\":[";
+      append_coords(line, ann.bboxes.data() + 8 * j, 8, _precision);
+      line += "],\"label\":";
+      append_json_string(line, dict.name(ann.labels[j]));
+      line += ",\"difficult\":";
+      str::append_int(line, ann.diffs[j]);
+      line += ann.trunc[j] ? ",\"truncated\":true}" : ",\"truncated\":false}";
+    }
+    line += "]}\n";
+    _out.append(line);
+  }
+
+  void close() override { _out.close(); }
+
+ private:
+  stream_file _out;
+  int _precision;
+};
+
+// COCO 格式: images 直接写入目标文件，annotations 先写入临时文件，
+// close 时拼接到 images 之后并写出 categories (category_id 为类别编号 + 1)
+class coco_sink : public ann_sink {
+ public:
+  coco_sink(const string &file, const int &precision)
+      : _file(file), _tmp_file(file + ".annotations.tmp"), _images(file),
+        _annotations(_tmp_file), _precision(precision), _next_image(1),
+        _next_ann(1) {
+    _images.append("{\"images\":[");
+  }
+
+  void write(const patch_ann_t &ann) override {
+    static thread_local string image, objects;
+    const size_t image_id = _next_image++;
+    const size_t first_ann = _next_ann.fetch_add(ann.labels.size());
+    image.assign("{\"id\":");
+    str::append_int(image, image_id);
+    image += ",\"file_name\":";
+    append_json_string(image, ann.file_name);
+    image += ",\"width\":";
+    str::append_int(image, ann.width);
+    image += ",\"height\":";
+    str::append_int(image, ann.height);
+    image += "}";
+    _images.append(image, true);
+
+    objects.clear();
+    for (size_t j = 0; j < ann.labels.size(); j++) {
+      const double *poly = ann.bboxes.data() + 8 * j;
+      double x_min = poly[0], x_max = poly[0], y_min = poly[1],
+             y_max = poly[1], area = 0;
+      for (int k = 0; k < 4; k++) {
+        const double *p = poly + 2 * k, *q = poly + 2 * ((k + 1) % 4);
+        x_min = std::min(x_min, p[0]);
+        x_max = std::max(x_max, p[0]);
+        y_min = std::min(y_min, p[1]);
+        y_max = std::max(y_max, p[1]);
+        area += p[0] * q[1] - q[0] * p[1];
+      }
+      const double bbox[4] = {x_min, y_min, x_max - x_min, y_max - y_min};
+      objects += j == 0 ? "{\"id\":" : ",\n{\"id\":";
+      str::append_int(objects, first_ann + j);
+      objects += ",\"image_id\":";
+      str::append_int(objects, image_id);
+      objects += ",\"category_id\":";
+      str::append_int(objects, ann.labels[j] + 1);
+      objects += ",\"segmentation\":[[";
+      append_coords(objects, poly, 8, _precision);
+      objects += "]],\"bbox\":[";
+      append_coords(objects, bbox, 4, _precision);
+      objects += "],\"area\":";
+      str::append_fixed(objects, std::fabs(area) / 2, _precision);
+      objects += ",\"iscrowd\":0,\"difficult\":";
+      str::append_int(objects, ann.diffs[j]);
+      objects += ann.trunc[j] ? ",\"truncated\":true}" : ",\"truncated\":false}";
+    }
+    if (!objects.empty()) {
+      _annotations.append(objects, true);
+    }
+  }
+
+  void close() override {
+    _annotations.close();
+    FILE *fp = _images.handle();
+    fputs("\n],\"annotations\":[", fp);
+    FILE *tmp = fopen(_tmp_file.c_str(), "rb");
+    CHECK_F(tmp != nullptr, "fopen %s: %s", _tmp_file.c_str(), strerror(errno));
+    vector<char> buf(kWriteBufferSize);
+    size_t n;
+    while ((n = fread(buf.data(), 1, buf.size(), tmp)) > 0) {
+      CHECK_F(fwrite(buf.data(), 1, n, fp) == n, "fwrite %s: %s",
+              _file.c_str(), strerror(errno));
+    }
+    fclose(tmp);
+    remove(_tmp_file.c_str());
+
+    auto &dict = class_dict::instance();
+    string categories("\n],\"categories\":[");
+    for (size_t i = 0; i < dict.size(); i++) {
+      categories += i == 0 ? "\n{\"id\":" : ",\n{\"id\":";
+      str::append_int(categories, i + 1);
+      categories += ",\"name\":";
+      append_json_string(categories, dict.name(i));
+      categories += "}";
+    }
+    categories += "\n]}\n";
+    fputs(categories.c_str(), fp);
+    _images.close();
+  }
+
+ private:
+  string _file;
+  string _tmp_file;
+  stream_file _images;
+  stream_file _annotations;
+  int _precision;
+  std::atomic<size_t> _next_image;
+  std::atomic<size_t> _next_ann;
+};
+
+std::unique_ptr<ann_sink> make_ann_sink(const string &format,
+                                        const string &path,
+                                        const int &precision,
+                                        tar_output *tar) {
+  if (format == "dota") {
+    return std::unique_ptr<ann_sink>(new dota_sink(path, precision, tar));
+  } else if (format == "jsonl") {
+    return std::unique_ptr<ann_sink>(new jsonl_sink(path, precision));
+  } else if (format == "coco") {
+    return std::unique_ptr<ann_sink>(new coco_sink(path, precision));
+  }
+  CHECK_F(false, "unsupport ann_format %s", format.c_str());
+  return nullptr;
+}
@@ -0,0 +1,247 @@
+#include "bit_depth.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "cpu_utils.hpp"
+#include "loguru.hpp"
+#include "pixel_dispatch.hpp"
+
+using std::string;
+using std::vector;
+
+// 量化后的级数，8 位输出的查找表按 12 位索引已经足够精确
+static const size_t kQuantizeLevels = 4096;
+// 逐块转换的元素数 (乘以周期)，中间缓冲区放在 L1/L2 中
+static const size_t kChunkPeriods = 256;
+
+stretch_t compute_stretch(GDALDataset *dataset, const string &method,
+                          const vector<double> &percent,
+                          const size_t &max_size) {
+  const size_t width = dataset->GetRasterXSize();
+  const size_t height = dataset->GetRasterYSize();
+  const double ratio =
+      std::min(1., static_cast<double>(max_size) / std::max(width, height));
+  const int buf_x = std::max(1L, std::lround(width * ratio));
+  const int buf_y = std::max(1L, std::lround(height * ratio));
+  stretch_t stretch;
+  vector<float> sample(static_cast<size_t>(buf_x) * buf_y);
+  for (int j = 1; j <= dataset->GetRasterCount(); j++) {
+    GDALRasterBand *band = dataset->GetRasterBand(j);
+    CPLErr ret = band->RasterIO(GF_Read, 0, 0, width, height, sample.data(),
+                                buf_x, buf_y, GDT_Float32, 0, 0);
+    CHECK_F(ret < CE_Failure, "RasterIO: %s", CPLGetLastErrorMsg());
+    int has_nodata = 0;
+    const double nodata = band->GetNoDataValue(&has_nodata);
+    vector<float> values;
+    values.reserve(sample.size());
+    for (auto &v : sample) {
+      if (!std::isnan(v) && (!has_nodata || v != nodata)) {
+        values.push_back(v);
+      }
+    }
+    double lo = 0, hi = 1;
+    if (!values.empty() && method == "percentile") {
+      auto at = [&values](const double &p) {
+        const size_t k = std::lround(std::min(std::max(p, 0.), 100.) / 100 *
+                                     (values.size() - 1));
+        std::nth_element(values.begin(), values.begin() + k, values.end());
+        return static_cast<double>(values[k]);
+      };
+      lo = at(percent[0]);
+      hi = at(percent[1]);
+    } else if (!values.empty()) {
+      auto minmax = std::minmax_element(values.begin(), values.end());
+      lo = *minmax.first;
+      hi = *minmax.second;
+    }
+    stretch.lo.push_back(lo);
+    stretch.hi.push_back(hi);
+  }
+  return stretch;
+}
+
+// dst[i * C + c] = lut[c][src[i * C + c] - base]
+template <typename T, int C>
+struct lookup {
+  static void run(const unsigned char *src, const unsigned char *lut,
+                  const size_t &lut_size, const int &nchannels, const int &base,
+                  unsigned char *dst, const size_t &npixels) {
+    const int nc = pixel::channels<C>::get(nchannels);
+    const T *in = reinterpret_cast<const T *>(src);
+    for (size_t i = 0; i < npixels; i++) {
+      for (int c = 0; c < nc; c++) {
+        dst[i * nc + c] = lut[c * lut_size + (in[i * nc + c] - base)];
+      }
+    }
+  }
+};
+
+depth_converter::depth_converter(const GDALDataType &data_type,
+                                 const int &nchannels, const stretch_t &stretch,
+                                 const double &gamma)
+    : _data_type(data_type), _nchannels(nchannels) {
+  CHECK_F(stretch.lo.size() == static_cast<size_t>(nchannels),
+          "stretch has %zu bands, image has %d", stretch.lo.size(), nchannels);
+  const bool direct = data_type == GDT_Byte || data_type == GDT_UInt16 ||
+                      data_type == GDT_Int16;
+  _lut_size = data_type == GDT_Byte ? 256 : direct ? 65536 : kQuantizeLevels;
+  // Int16 的表从 -32768 开始
+  const double base = data_type == GDT_Int16 ? -32768 : 0;
+  _lut.resize(_lut_size * nchannels);
+  for (int c = 0; c < nchannels; c++) {
+    const double lo = stretch.lo[c];
+    const double range = std::max(stretch.hi[c] - lo, 1e-12);
+    for (size_t i = 0; i < _lut_size; i++) {
+      double t = direct ? (base + i - lo) / range
+                        : static_cast<double>(i) / (kQuantizeLevels - 1);
+      t = std::min(std::max(t, 0.), 1.);
+      if (gamma != 1) {
+        t = std::pow(t, 1 / gamma);
+      }
+      _lut[c * _lut_size + i] = static_cast<unsigned char>(std::lround(255 * t));
+    }
+  }
+  // 查表内核只按原始整数类型或 12 位量化结果区分
+  if (data_type == GDT_Byte) {
+    _lookup = pixel::select_channels<
+        pixel::bind_type<lookup, unsigned char>::template type>(nchannels);
+  } else if (data_type == GDT_Int16) {
+    _lookup = pixel::select_channels<
+        pixel::bind_type<lookup, short>::template type>(nchannels);
+  } else {
+    _lookup = pixel::select_channels<
+        pixel::bind_type<lookup, unsigned short>::template type>(nchannels);
+  }
+  if (!direct) {
+    const size_t period = 8 * nchannels;
+    _offset.resize(period);
+    _scale.resize(period);
+    for (size_t j = 0; j < period; j++) {
+      const int c = j % nchannels;
+      _offset[j] = static_cast<float>(stretch.lo[c]);
+      _scale[j] = static_cast<float>(
+          (kQuantizeLevels - 1) /
+          std::max(stretch.hi[c] - stretch.lo[c], 1e-12));
+    }
+  }
+}
+
+static void quantize_row(const float *src, const float *offset,
+                         const float *scale, const size_t &period,
+                         unsigned short *dst, const size_t &n) {
+  switch (cpu::simd_level()) {
+#if defined(__x86_64__) || defined(__i386__)
+  case cpu::kAVX2:
+    quantize_row_avx2(src, offset, scale, period, dst, n);
+    return;
+#endif
+#if defined(__SSE2__)
+  case cpu::kSSE2:
+    quantize_row_sse2(src, offset, scale, period, dst, n);
+    return;
+#endif
+  default:
+    quantize_row_scalar(src, offset, scale, period, dst, n);
+  }
+}
+
+void depth_converter::convert(patch_t &patch) const {
+  CHECK_F(patch.data_type == _data_type && patch.nchannels == _nchannels,
+          "patch does not match the converter");
+  const size_t npixels = patch.width * patch.height;
+  const size_t n = npixels * _nchannels;
+  // 输出元素 i 写在字节 i，不超过输入元素 i 的位置，可以原地从前向后转换
+  unsigned char *data = patch.data.data();
+  if (_offset.empty()) {
+    _lookup(data, _lut.data(), _lut_size, _nchannels,
+            _data_type == GDT_Int16 ? -32768 : 0, data, npixels);
+  } else {
+    const size_t period = _offset.size();
+    const size_t chunk = period * kChunkPeriods;
+    static thread_local vector<float> values;
+    static thread_local vector<unsigned short> levels;
+    values.resize(chunk);
+    levels.resize(chunk);
+    for (size_t b = 0; b < n; b += chunk) {
+      const size_t m = std::min(chunk, n - b);
+      const float *src = values.data();
+      if (_data_type == GDT_Float32) {
+        src = reinterpret_cast<const float *>(data) + b;
+      } else {
+        GDALCopyWords(data + b * patch.data_size, _data_type, patch.data_size,
+                      values.data(), GDT_Float32, sizeof(float), m);
+      }
+      quantize_row(src, _offset.data(), _scale.data(), period, levels.data(),
+                   m);
+      // b 是周期的整数倍，块内从第 0 个波段开始
+      _lookup(reinterpret_cast<const unsigned char *>(levels.data()),
+              _lut.data(), _lut_size, _nchannels, 0, data + b,
+              m / _nchannels);
+    }
+  }
+  patch.data_type = GDT_Byte;
+  patch.data_size = 1;
+  patch.data.resize(n);
+}
+
+static inline unsigned short quantize(const float &v, const float &offset,
+                                      const float &scale) {
+  float x = (v - offset) * scale;
+  x = x > 0.f ? x : 0.f;
+  x = x < 4095.f ? x : 4095.f;
+  return static_cast<unsigned short>(x + 0.5f);
+}
+
+void quantize_row_scalar(const float *src, const float *offset,
+                         const float *scale, const size_t &period,
+                         unsigned short *dst, const size_t &n) {
+  for (size_t b = 0; b < n; b += period) {
+    const size_t m = std::min(period, n - b);
+    for (size_t j = 0; j < m; j++) {
+      dst[b + j] = quantize(src[b + j], offset[j], scale[j]);
+    }
+  }
+}
+
+#if defined(__SSE2__)
+void quantize_row_sse2(const float *src, const float *offset,
+                       const float *scale, const size_t &period,
+                       unsigned short *dst, const size_t &n) {
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 top = _mm_set1_ps(4095.f);
+  const __m128 half = _mm_set1_ps(0.5f);
+  for (size_t b = 0; b < n; b += period) {
+    const size_t m = std::min(period, n - b);
+    size_t j = 0;
+    for (; j + 8 <= m; j += 8) {
+      __m128i q[2];
+      for (int h = 0; h < 2; h++) {
+        const size_t k = j + 4 * h;
+        // max/min 的第一个操作数为 NaN 时返回第二个，NaN 量化为 0
+        __m128 x = _mm_mul_ps(
+            _mm_sub_ps(_mm_loadu_ps(src + b + k), _mm_loadu_ps(offset + k)),
+            _mm_loadu_ps(scale + k));
+        x = _mm_min_ps(_mm_max_ps(x, zero), top);
+        q[h] = _mm_cvttps_epi32(_mm_add_ps(x, half));
+      }
+      // 结果在 [0, 4095]，有符号饱和打包不会截断
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + b + j),
+                       _mm_packs_epi32(q[0], q[1]));
+    }
+    for (; j < m; j++) {
+      dst[b + j] = quantize(src[b + j], offset[j], scale[j]);
+    }
+  }
+}
+#else
+void quantize_row_sse2(const float *src, const float *offset,
+                       const float *scale, const size_t &period,
+                       unsigned short *dst, const size_t &n) {
+  quantize_row_scalar(src, offset, scale, period, dst, n);
+}
+#endif
@@ -0,0 +1,36 @@
+// 本文件以 -mavx2 编译 (见 CMakeLists.txt)，只在 cpu::simd_level() 为 AVX2 时调用
+#include "bit_depth.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+void quantize_row_avx2(const float *src, const float *offset,
+                       const float *scale, const size_t &period,
+                       unsigned short *dst, const size_t &n) {
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 top = _mm256_set1_ps(4095.f);
+  const __m256 half = _mm256_set1_ps(0.5f);
+  size_t b = 0;
+  for (; b + period <= n; b += period) {
+    for (size_t j = 0; j < period; j += 8) {
+      __m256 x = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(src + b + j),
+                                             _mm256_loadu_ps(offset + j)),
+                               _mm256_loadu_ps(scale + j));
+      x = _mm256_min_ps(_mm256_max_ps(x, zero), top);
+      const __m256i q = _mm256_cvttps_epi32(_mm256_add_ps(x, half));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + b + j),
+                       _mm_packs_epi32(_mm256_castsi256_si128(q),
+                                       _mm256_extracti128_si256(q, 1)));
+    }
+  }
+  // 不足一个周期的尾部从周期起点开始，offset/scale 下标不变
+  quantize_row_scalar(src + b, offset, scale, period, dst + b, n - b);
+}
+#else
+// 编译器不支持 AVX2 时退回标量实现
+void quantize_row_avx2(const float *src, const float *offset,
+                       const float *scale, const size_t &period,
+                       unsigned short *dst, const size_t &n) {
+  quantize_row_scalar(src, offset, scale, period, dst, n);
+}
+#endif
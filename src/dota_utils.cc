@@ -3,12 +3,16 @@
 #include <gdal_priv.h>
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
-#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <loguru.hpp>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <unordered_set>
 
 #include "path_utils.hpp"
@@ -25,70 +29,289 @@ enum ContentType {
   kEmpty = 0,
 };
 
+static std::atomic<size_t> num_filtered(0); // 不在固定类别表中的对象数
+
+class_dict &class_dict::instance() {
+  static class_dict dict;
+  return dict;
+}
+
+void class_dict::set_classes(const vector<string> &classes) {
+  std::lock_guard<std::mutex> lg(_lock);
+  _ids.clear();
+  _names.clear();
+  for (auto &name : classes) {
+    if (_ids.emplace(name, _names.size()).second) {
+      _names.push_back(name);
+    }
+  }
+  _fixed = true;
+}
+
+void class_dict::set_classes(const string &preset) {
+  vector<string> classes{"plane",
+                         "baseball-diamond",
+                         "bridge",
+                         "ground-track-field",
+                         "small-vehicle",
+                         "large-vehicle",
+                         "ship",
+                         "tennis-court",
+                         "basketball-court",
+                         "storage-tank",
+                         "soccer-ball-field",
+                         "roundabout",
+                         "harbor",
+                         "swimming-pool",
+                         "helicopter"};
+  const string &&_preset = str::tolower(preset);
+  CHECK_F(_preset == "dota1.0" || _preset == "dota1.5" || _preset == "dota2.0",
+          "unsupport classes %s", preset.c_str());
+  if (_preset == "dota1.5" || _preset == "dota2.0") {
+    classes.push_back("container-crane");
+  }
+  if (_preset == "dota2.0") {
+    classes.push_back("airport");
+    classes.push_back("helipad");
+  }
+  set_classes(classes);
+}
+
+int class_dict::intern(const string &name) {
+  std::lock_guard<std::mutex> lg(_lock);
+  auto it = _ids.find(name);
+  if (it != _ids.end()) {
+    return it->second;
+  }
+  if (_fixed) {
+    return -1;
+  }
+  _names.push_back(name);
+  return _ids.emplace(name, _names.size() - 1).first->second;
+}
+
+const string &class_dict::name(const int &id) const {
+  std::lock_guard<std::mutex> lg(_lock);
+  return _names[id];
+}
+
+size_t class_dict::size() const {
+  std::lock_guard<std::mutex> lg(_lock);
+  return _names.size();
+}
+
+void count_classes(const vector<int> &labels, class_stats_t &stats) {
+  for (auto &label : labels) {
+    if (stats.size() <= static_cast<size_t>(label)) {
+      stats.resize(label + 1, 0);
+    }
+    stats[label]++;
+  }
+}
+
+void merge_class_stats(const class_stats_t &src, class_stats_t &dst) {
+  if (dst.size() < src.size()) {
+    dst.resize(src.size(), 0);
+  }
+  for (size_t i = 0; i < src.size(); i++) {
+    dst[i] += src[i];
+  }
+}
+
+void log_class_stats(const string &title, const class_stats_t &stats) {
+  auto &dict = class_dict::instance();
+  std::stringstream ss;
+  for (size_t i = 0; i < dict.size(); i++) {
+    ss << "\n  " << dict.name(i) << ": " << (i < stats.size() ? stats[i] : 0);
+  }
+  LOG(INFO) << title << ss.str() << endl;
+}
+
+// 把整个文件读入 buf，复用 buf 的容量，末尾保证有 '\0'
+static bool slurp(const string &file, string &buf) {
+  FILE *fp = fopen(file.c_str(), "rb");
+  if (fp == nullptr) {
+    return false;
+  }
+  fseek(fp, 0, SEEK_END);
+  const long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  buf.resize(size > 0 ? size : 0);
+  const size_t n = buf.empty() ? 0 : fread(&buf[0], 1, buf.size(), fp);
+  buf.resize(n);
+  fclose(fp);
+  return true;
+}
+
+static inline bool is_blank(const char &c) { return c == ' ' || c == '\t'; }
+
+static inline bool is_digit(const char &c) { return c >= '0' && c <= '9'; }
+
+// 解析 p 开头的十进制数，结果与 std::stod 一致 (数后的多余字符同样忽略)。
+// 尾数不超过 2^53 且 10 的指数不超过 22 时一次乘除即正确舍入，
+// 指数形式、过长的尾数和 inf/nan 等交给 strtod
+static bool parse_double(const char *p, const char *end, double &value) {
+  static const double kPow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                  1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                  1e18, 1e19, 1e20, 1e21, 1e22};
+  const char *s = p;
+  const bool negative = s < end && *s == '-';
+  if (s < end && (*s == '-' || *s == '+')) {
+    s++;
+  }
+  unsigned long long mantissa = 0;
+  int num_digits = 0, exp10 = 0;
+  bool any_digit = false;
+  for (; s < end && is_digit(*s); s++) {
+    mantissa = mantissa * 10 + (*s - '0');
+    num_digits += mantissa != 0;
+    any_digit = true;
+  }
+  if (s < end && *s == '.') {
+    for (s++; s < end && is_digit(*s); s++) {
+      mantissa = mantissa * 10 + (*s - '0');
+      num_digits += mantissa != 0;
+      any_digit = true;
+      exp10--;
+    }
+  }
+  const bool fast =
+      any_digit &&
+      !(s < end && (*s == 'e' || *s == 'E' || *s == 'x' || *s == 'X')) &&
+      num_digits <= 18 && mantissa <= (1ULL << 53) && exp10 >= -22;
+  if (fast) {
+    value = exp10 < 0 ? mantissa / kPow10[-exp10] : mantissa * kPow10[exp10];
+    value = negative ? -value : value;
+    return true;
+  }
+  char *stop = nullptr;
+  value = strtod(p, &stop);
+  return stop != p;
+}
+
+// 解析一行 DOTA 标注: 8 个坐标、类别名和可选的难度，以空格或制表符分隔
+static void parse_object(const char *p, const char *end,
+                         std::unordered_map<string, int> &class_ids,
+                         string &name, ann_t &ann) {
+  const char *tokens[11];
+  const char *token_ends[11];
+  int num_tokens = 0;
+  while (p < end && num_tokens < 11) {
+    while (p < end && is_blank(*p)) {
+      p++;
+    }
+    if (p == end) {
+      break;
+    }
+    tokens[num_tokens] = p;
+    while (p < end && !is_blank(*p)) {
+      p++;
+    }
+    token_ends[num_tokens++] = p;
+  }
+  if (num_tokens < 9) {
+    return;
+  }
+  // 先校验坐标，格式错误的行不能在全局类别表中留下类别
+  double coords[8];
+  for (int i = 0; i < 8; i++) {
+    if (!parse_double(tokens[i], token_ends[i], coords[i])) {
+      return;
+    }
+  }
+  name.assign(tokens[8], token_ends[8]);
+  auto it = class_ids.find(name);
+  if (it == class_ids.end()) {
+    it = class_ids.emplace(name, class_dict::instance().intern(name)).first;
+  }
+  if (it->second < 0) {
+    num_filtered++;
+    return;
+  }
+  ann.bboxes.insert(ann.bboxes.end(), coords, coords + 8);
+  ann.labels.push_back(it->second);
+  // 与原来按单个空格切分一致，恰好 10 列时最后一列为难度
+  int diff = 0;
+  if (num_tokens == 10) {
+    const char *q = tokens[9];
+    const bool negative = *q == '-';
+    q += *q == '-' || *q == '+';
+    for (; q < token_ends[9] && is_digit(*q); q++) {
+      diff = diff * 10 + (*q - '0');
+    }
+    diff = negative ? -diff : diff;
+  }
+  ann.diffs.push_back(diff);
+}
+
+static inline bool line_starts_with(const char *p, const char *end,
+                                    const char *prefix) {
+  const size_t n = strlen(prefix);
+  return static_cast<size_t>(end - p) >= n && memcmp(p, prefix, n) == 0;
+}
+
 content_t _load_dota_txt(const string &txt_file) {
   float gsd = kEmpty;
-  vector<vector<double>> bboxes;
-  vector<string> labels;
-  vector<int> diffs;
+  ann_t ann;
   if (!txt_file.empty()) {
     do {
-      if (!path::is_file(txt_file)) {
+      // 每个线程复用读入缓冲区和类别名缓冲区，逐行解析时不再分配内存
+      static thread_local string buf;
+      static thread_local string name;
+      if (!path::is_file(txt_file) || !slurp(txt_file, buf)) {
         LOG(INFO) << "can't find " << txt_file << ", treated as empty txt_file"
                   << endl;
         break;
       }
 
-      std::ifstream input_file(txt_file);
-      auto lines_count = std::count(std::istreambuf_iterator<char>(input_file),
-                                    std::istreambuf_iterator<char>(), '\n') +
-                         1; // 统计文件行数，最后一行统计不到
-
-      bboxes.reserve(lines_count);
-      labels.reserve(lines_count);
-      diffs.reserve(lines_count);
+      const char *p = buf.data();
+      const char *const end = p + buf.size();
+      const size_t lines_count = std::count(p, end, '\n') + 1;
+      ann.bboxes.reserve(lines_count * 8);
+      ann.labels.reserve(lines_count);
+      ann.diffs.reserve(lines_count);
+      std::unordered_map<string, int> class_ids; // 本文件内缓存，减少全局加锁
 
-      input_file.seekg(std::ios::beg);
-
-      string line;
-      while (std::getline(input_file, line)) { // 读入消耗掉换行符
-        auto left = line.rfind('\r');
-        if (left != std::string::npos) {
-          line = line.substr(0, left);
+      while (p < end) {
+        const char *eol = static_cast<const char *>(memchr(p, '\n', end - p));
+        eol = eol != nullptr ? eol : end;
+        // 去掉最后一个 '\r' 及之后的内容
+        const char *line_end = eol;
+        for (const char *q = eol; q > p;) {
+          if (*--q == '\r') {
+            line_end = q;
+            break;
+          }
         }
-        if (line.empty()) {
+        const char *line = p;
+        p = eol + 1;
+        if (line == line_end) {
           continue;
         }
-        if (str::starts_with(line, "gsd")) {
-          auto pos = line.find(':');
-          if (pos != string::npos) {
-            auto gsd_str = line.substr(pos + 1);
-            try {
-              gsd = std::stof(gsd_str);
-            } catch (std::invalid_argument &invalid) {
+        if (line_starts_with(line, line_end, "gsd")) {
+          const char *colon = static_cast<const char *>(
+              memchr(line, ':', line_end - line));
+          if (colon != nullptr) {
+            // 与 std::stof 一致，只看冒号后的数字
+            const string value(colon + 1, line_end);
+            char *stop = nullptr;
+            gsd = strtof(value.c_str(), &stop);
+            if (stop == value.c_str()) {
               gsd = kParseError;
             }
           }
           continue;
-        } else if (str::starts_with(line, "imagesource") ||
-                   str::starts_with(line, "NAN") ||
-                   str::starts_with(line, "NaN")) {
+        } else if (line_starts_with(line, line_end, "imagesource") ||
+                   line_starts_with(line, line_end, "NAN") ||
+                   line_starts_with(line, line_end, "NaN")) {
           continue;
         }
-        auto line_split = str::split(line);
-        if (line_split.size() >= 9) {
-          vector<double> bbox(8, 0);
-          std::transform(line_split.begin(), line_split.begin() + 8,
-                         bbox.begin(),
-                         [](string valstr) { return std::stod(valstr); });
-          bboxes.push_back(bbox);
-          labels.push_back(line_split[8]);
-          diffs.push_back(line_split.size() == 10 ? std::stoi(line_split[9])
-                                                  : 0);
-        }
+        parse_object(line, line_end, class_ids, name, ann);
       }
     } while (0);
   }
-  return content_t{gsd, "", "", 0, 0, {bboxes, labels, diffs}};
+  return content_t{gsd, "", "", 0, 0, ann};
 }
 
 content_t _load_dota_single(const string &img_file, const string &ann_dir) {
@@ -103,16 +326,32 @@ content_t _load_dota_single(const string &img_file, const string &ann_dir) {
       static_cast<GDALDataset *>(GDALOpen(img_file.c_str(), GA_ReadOnly));
   int width = dataset->GetRasterXSize();
   int height = dataset->GetRasterYSize();
+  const char *compression =
+      dataset->GetMetadataItem("COMPRESSION", "IMAGE_STRUCTURE");
   string txt_file = ann_dir.empty() ? "" : (ann_dir + img_id + ".txt");
   content_t content = _load_dota_txt(txt_file);
   content.width = width;
   content.height = height;
   content.filename = path::basename(img_file);
   content.id = img_id;
+  content.nchannels = dataset->GetRasterCount();
+  content.data_type = dataset->GetRasterBand(1)->GetRasterDataType();
+  if (compression != nullptr) {
+    content.compression = str::toupper(compression);
+  } else {
+    content.compression =
+        ext == "png" ? "DEFLATE" : ext == "jpg" ? "JPEG" : "NONE";
+  }
   GDALClose(static_cast<GDALDatasetH>(dataset));
   return content;
 }
 
+bool load_dota_single(const string &img_file, const string &ann_dir,
+                      content_t &content) {
+  content = _load_dota_single(img_file, ann_dir);
+  return content.gsd != kUnSupport;
+}
+
 vector<content_t> load_dota(const string &img_dir, const string &ann_dir,
                             const int &nthread) {
   LOG(INFO) << "starting loading the dataset information." << endl;
@@ -121,17 +360,15 @@ vector<content_t> load_dota(const string &img_dir, const string &ann_dir,
     return _load_dota_single(img_file, ann_dir);
   };
   auto path_set = path::glob(img_dir + "*");
-  vector<content_t> contents;
-  contents.reserve(path_set.size());
+  vector<content_t> contents(path_set.size());
   if (nthread > 1) {
-    std::threadpool pool(nthread); // try openmp
-    auto contents_future = pool.map_container(_load_func, path_set);
-    for (auto &content_future : contents_future) {
-      contents.push_back(content_future.get());
-    }
+    std::threadpool::instance(nthread).parallel_for(
+        0, path_set.size(), 1, [&contents, &path_set, &_load_func](size_t i) {
+          contents[i] = _load_func(path_set[i]);
+        });
   } else {
-    std::transform(path_set.begin(), path_set.end(),
-                   std::back_inserter(contents), _load_func);
+    std::transform(path_set.begin(), path_set.end(), contents.begin(),
+                   _load_func);
   }
   contents.erase(std::remove_if(contents.begin(), contents.end(),
                                 [](const content_t &content) {
@@ -139,6 +376,10 @@ vector<content_t> load_dota(const string &img_dir, const string &ann_dir,
                                 }),
                  contents.end());
   auto end_time = std::chrono::system_clock::now();
+  const size_t filtered = take_num_filtered();
+  if (filtered > 0) {
+    LOG(INFO) << "ignore " << filtered << " objects not in classes" << endl;
+  }
   LOG(INFO) << "finishing loading dataset, get " << contents.size()
             << " images,"
             << " using "
@@ -148,3 +389,5 @@ vector<content_t> load_dota(const string &img_dir, const string &ann_dir,
             << "s." << endl;
   return contents;
 }
+
+size_t take_num_filtered() { return num_filtered.exchange(0); }
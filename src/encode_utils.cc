@@ -0,0 +1,578 @@
+#include "encode_utils.h"
+
+#include <gdal_priv.h>
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef WITH_LIBPNG
+#include <png.h>
+#include <zlib.h>
+#endif
+#ifdef WITH_LIBJPEG
+#include <jpeglib.h>
+#endif
+#ifdef WITH_LIBTIFF
+#include <tiffio.h>
+#endif
+
+#include "loguru.hpp"
+#include "path_utils.hpp"
+#include "read_utils.h"
+#include "string_utils.hpp"
+
+using std::string;
+using std::vector;
+
+string get_gdal_image_type(const string &file) {
+  static const std::unordered_map<string, string> suffix2gdal{{
+      {"png", "PNG"},
+      {"bmp", "BMP"},
+      {"jpg", "JPEG"},
+      {"tif", "GTiff"},
+      {"tiff", "GTiff"},
+  }};
+  const string file_suffix = str::tolower(path::suffix(file));
+  if (suffix2gdal.find(file_suffix) == suffix2gdal.end()) {
+    return "";
+  }
+  const string &gdal_type = suffix2gdal.at(file_suffix);
+  return gdal_type;
+}
+
+encode_options_t get_encode_preset(const string &preset) {
+  static const std::unordered_map<string, encode_options_t> presets{{
+      {"default", {}},
+      {"fast",
+       {{"ZLEVEL", "1"},
+        {"FILTER", "SUB"},
+        {"DCT_METHOD", "IFAST"},
+        {"COMPRESS", "NONE"}}},
+      {"small",
+       {{"ZLEVEL", "9"},
+        {"FILTER", "ALL"},
+        {"COMPRESS", "DEFLATE"},
+        {"PREDICTOR", "2"}}},
+  }};
+  auto it = presets.find(str::tolower(preset));
+  CHECK_F(it != presets.end(), "unsupport save_preset %s", preset.c_str());
+  return it->second;
+}
+
+#if defined(WITH_LIBPNG) || defined(WITH_LIBJPEG) || defined(WITH_LIBTIFF)
+static string option_str(const encode_options_t &options, const string &key,
+                         const string &value) {
+  auto it = options.find(key);
+  if (it == options.end()) {
+    return value;
+  }
+  return str::toupper(it->second);
+}
+
+static int option_int(const encode_options_t &options, const string &key,
+                      const int &value, const int &lo, const int &hi) {
+  auto it = options.find(key);
+  if (it == options.end()) {
+    return value;
+  }
+  int res = value;
+  try {
+    res = std::stoi(it->second);
+  } catch (std::exception &e) {
+    ABORT_F("invalid save option %s=%s", key.c_str(), it->second.c_str());
+  }
+  CHECK_F(res >= lo && res <= hi, "save option %s=%d out of range [%d, %d]",
+          key.c_str(), res, lo, hi);
+  return res;
+}
+#endif
+
+class gdal_encoder : public encoder {
+ public:
+  gdal_encoder(const string &gdal_type, const encode_options_t &options)
+      : _gdal_type(gdal_type), _options(nullptr) {
+    _driver = GetGDALDriverManager()->GetDriverByName(gdal_type.c_str());
+    CHECK_F(_driver != nullptr, "GetDriverByName \"%s\": %s",
+            gdal_type.c_str(), CPLGetLastErrorMsg());
+    char name[64] = {0};
+    snprintf(name, sizeof(name), "/vsimem/dota_split_%p", (void *)this);
+    _vsi_file = name;
+
+    // 只传驱动声明过的创建选项，其余 (如 png 的 FILTER) 由直接编码器使用
+    const char *option_list =
+        _driver->GetMetadataItem(GDAL_DMD_CREATIONOPTIONLIST);
+    const string supported = option_list ? option_list : "";
+    for (auto &option : options) {
+      if (supported.find("name='" + option.first + "'") != string::npos) {
+        _options = CSLSetNameValue(_options, option.first.c_str(),
+                                   option.second.c_str());
+      }
+    }
+  }
+
+  gdal_encoder(const gdal_encoder &) = delete;
+
+  ~gdal_encoder() { CSLDestroy(_options); }
+
+  void encode(const patch_t &patch, vector<unsigned char> &out) override {
+    GDALDataset *mem_dataset = wrap_patch(patch);
+    auto out_dataset = _driver->CreateCopy(_vsi_file.c_str(), mem_dataset,
+                                           FALSE, _options, nullptr, nullptr);
+    CHECK_F(out_dataset != nullptr, "CreateCopy %s: %s", _gdal_type.c_str(),
+            CPLGetLastErrorMsg());
+    GDALClose(static_cast<GDALDatasetH>(out_dataset));
+    GDALClose(static_cast<GDALDatasetH>(mem_dataset));
+
+    vsi_l_offset size = 0;
+    unsigned char *buf = VSIGetMemFileBuffer(_vsi_file.c_str(), &size, TRUE);
+    CHECK_F(buf != nullptr, "VSIGetMemFileBuffer %s", _vsi_file.c_str());
+    out.assign(buf, buf + size);
+    VSIFree(buf);
+    VSIUnlink((_vsi_file + ".aux.xml").c_str());
+  }
+
+ private:
+  string _gdal_type;
+  string _vsi_file;
+  GDALDriver *_driver;
+  char **_options;
+};
+
+#ifdef WITH_LIBPNG
+static void png_error_fn(png_structp, png_const_charp msg) {
+  ABORT_F("libpng: %s", msg);
+}
+
+static void png_warning_fn(png_structp, png_const_charp msg) {
+  LOG(WARNING) << "libpng: " << msg << std::endl;
+}
+
+static void png_write_fn(png_structp png, png_bytep data, png_size_t length) {
+  auto out = static_cast<vector<unsigned char> *>(png_get_io_ptr(png));
+  out->insert(out->end(), data, data + length);
+}
+
+static void png_flush_fn(png_structp) {}
+
+class png_encoder : public encoder {
+ public:
+  explicit png_encoder(const encode_options_t &options)
+      : _fallback("PNG", options) {
+    static const std::unordered_map<string, int> filters{{
+        {"NONE", PNG_FILTER_NONE},
+        {"SUB", PNG_FILTER_SUB},
+        {"UP", PNG_FILTER_UP},
+        {"AVG", PNG_FILTER_AVG},
+        {"PAETH", PNG_FILTER_PAETH},
+        {"ALL", PNG_ALL_FILTERS},
+    }};
+    static const std::unordered_map<string, int> strategies{{
+        {"DEFAULT", Z_DEFAULT_STRATEGY},
+        {"FILTERED", Z_FILTERED},
+        {"HUFFMAN", Z_HUFFMAN_ONLY},
+        {"RLE", Z_RLE},
+        {"FIXED", Z_FIXED},
+    }};
+    _zlevel = option_int(options, "ZLEVEL", 6, 0, 9);
+    const string filter = option_str(options, "FILTER", "");
+    CHECK_F(filter.empty() || filters.count(filter), "unsupport FILTER %s",
+            filter.c_str());
+    _filter = filter.empty() ? -1 : filters.at(filter);
+    const string strategy = option_str(options, "STRATEGY", "");
+    CHECK_F(strategy.empty() || strategies.count(strategy),
+            "unsupport STRATEGY %s", strategy.c_str());
+    _strategy = strategy.empty() ? -1 : strategies.at(strategy);
+  }
+
+  void encode(const patch_t &patch, vector<unsigned char> &out) override {
+    static const int color_types[] = {PNG_COLOR_TYPE_GRAY,
+                                      PNG_COLOR_TYPE_GRAY_ALPHA,
+                                      PNG_COLOR_TYPE_RGB,
+                                      PNG_COLOR_TYPE_RGB_ALPHA};
+    if ((patch.data_type != GDT_Byte && patch.data_type != GDT_UInt16) ||
+        patch.nchannels < 1 || patch.nchannels > 4) {
+      _fallback.encode(patch, out);
+      return;
+    }
+    out.clear();
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr,
+                                              png_error_fn, png_warning_fn);
+    CHECK_F(png != nullptr, "png_create_write_struct");
+    png_infop info = png_create_info_struct(png);
+    CHECK_F(info != nullptr, "png_create_info_struct");
+    png_set_write_fn(png, &out, png_write_fn, png_flush_fn);
+    png_set_compression_level(png, _zlevel);
+    if (_filter >= 0) {
+      png_set_filter(png, PNG_FILTER_TYPE_BASE, _filter);
+    }
+    if (_strategy >= 0) {
+      png_set_compression_strategy(png, _strategy);
+    }
+    png_set_IHDR(png, info, patch.width, patch.height,
+                 static_cast<int>(patch.data_size * 8),
+                 color_types[patch.nchannels - 1], PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png, info);
+    if (patch.data_size == 2) {
+      png_set_swap(png); // png 的 16 位采样是大端序
+    }
+
+    const size_t line_size = patch.width * patch.nchannels * patch.data_size;
+    _rows.resize(patch.height);
+    for (size_t y = 0; y < patch.height; y++) {
+      _rows[y] = const_cast<png_bytep>(patch.data.data() + y * line_size);
+    }
+    png_write_image(png, _rows.data());
+    png_write_end(png, nullptr);
+    png_destroy_write_struct(&png, &info);
+  }
+
+ private:
+  gdal_encoder _fallback;
+  int _zlevel;
+  int _filter;
+  int _strategy;
+  vector<png_bytep> _rows;
+};
+#endif
+
+#ifdef WITH_LIBJPEG
+static void jpeg_error_fn(j_common_ptr cinfo) {
+  char msg[JMSG_LENGTH_MAX] = {0};
+  (*cinfo->err->format_message)(cinfo, msg);
+  ABORT_F("libjpeg: %s", msg);
+}
+
+// 把压缩数据直接写入复用的 vector，避免 jpeg_mem_dest 的额外 malloc 和拷贝
+typedef struct {
+  struct jpeg_destination_mgr pub;
+  vector<unsigned char> *out;
+} jpeg_vector_dest_t;
+
+static void jpeg_init_dest(j_compress_ptr cinfo) {
+  auto dest = reinterpret_cast<jpeg_vector_dest_t *>(cinfo->dest);
+  dest->out->resize(std::max<size_t>(dest->out->capacity(), 1 << 16));
+  dest->pub.next_output_byte = dest->out->data();
+  dest->pub.free_in_buffer = dest->out->size();
+}
+
+static boolean jpeg_empty_output(j_compress_ptr cinfo) {
+  auto dest = reinterpret_cast<jpeg_vector_dest_t *>(cinfo->dest);
+  const size_t used = dest->out->size();
+  dest->out->resize(used * 2);
+  dest->pub.next_output_byte = dest->out->data() + used;
+  dest->pub.free_in_buffer = dest->out->size() - used;
+  return TRUE;
+}
+
+static void jpeg_term_dest(j_compress_ptr cinfo) {
+  auto dest = reinterpret_cast<jpeg_vector_dest_t *>(cinfo->dest);
+  dest->out->resize(dest->out->size() - dest->pub.free_in_buffer);
+}
+
+class jpeg_encoder : public encoder {
+ public:
+  explicit jpeg_encoder(const encode_options_t &options)
+      : _fallback("JPEG", options) {
+    static const std::unordered_map<string, J_DCT_METHOD> dct_methods{{
+        {"ISLOW", JDCT_ISLOW},
+        {"IFAST", JDCT_IFAST},
+        {"FLOAT", JDCT_FLOAT},
+    }};
+    _quality = option_int(options, "QUALITY", 75, 1, 100);
+    const string dct_method = option_str(options, "DCT_METHOD", "ISLOW");
+    CHECK_F(dct_methods.count(dct_method), "unsupport DCT_METHOD %s",
+            dct_method.c_str());
+    _dct_method = dct_methods.at(dct_method);
+
+    _cinfo.err = jpeg_std_error(&_jerr);
+    _jerr.error_exit = jpeg_error_fn;
+    jpeg_create_compress(&_cinfo);
+    _dest.pub.init_destination = jpeg_init_dest;
+    _dest.pub.empty_output_buffer = jpeg_empty_output;
+    _dest.pub.term_destination = jpeg_term_dest;
+    _cinfo.dest = &_dest.pub;
+  }
+
+  ~jpeg_encoder() { jpeg_destroy_compress(&_cinfo); }
+
+  void encode(const patch_t &patch, vector<unsigned char> &out) override {
+    if (patch.data_type != GDT_Byte ||
+        (patch.nchannels != 1 && patch.nchannels != 3)) {
+      _fallback.encode(patch, out);
+      return;
+    }
+    _dest.out = &out;
+    _cinfo.image_width = patch.width;
+    _cinfo.image_height = patch.height;
+    _cinfo.input_components = patch.nchannels;
+    _cinfo.in_color_space = patch.nchannels == 3 ? JCS_RGB : JCS_GRAYSCALE;
+    jpeg_set_defaults(&_cinfo);
+    jpeg_set_quality(&_cinfo, _quality, TRUE);
+    _cinfo.dct_method = _dct_method;
+    jpeg_start_compress(&_cinfo, TRUE);
+
+    const size_t line_size = patch.width * patch.nchannels;
+    while (_cinfo.next_scanline < _cinfo.image_height) {
+      JSAMPROW row = const_cast<JSAMPROW>(patch.data.data() +
+                                          _cinfo.next_scanline * line_size);
+      jpeg_write_scanlines(&_cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&_cinfo);
+  }
+
+ private:
+  gdal_encoder _fallback;
+  int _quality;
+  J_DCT_METHOD _dct_method;
+  struct jpeg_compress_struct _cinfo;
+  struct jpeg_error_mgr _jerr;
+  jpeg_vector_dest_t _dest;
+};
+#endif
+
+#ifdef WITH_LIBTIFF
+static void tiff_error_fn(const char *module, const char *fmt, va_list ap) {
+  char msg[1024] = {0};
+  vsnprintf(msg, sizeof(msg), fmt, ap);
+  ABORT_F("libtiff %s: %s", module ? module : "", msg);
+}
+
+// TIFFClientOpen 的内存读写回调
+typedef struct {
+  vector<unsigned char> *out;
+  toff_t pos;
+} tiff_vector_io_t;
+
+static tmsize_t tiff_read_fn(thandle_t, void *, tmsize_t) { return 0; }
+
+static tmsize_t tiff_write_fn(thandle_t handle, void *data, tmsize_t size) {
+  auto io = static_cast<tiff_vector_io_t *>(handle);
+  if (io->out->size() < io->pos + size) {
+    io->out->resize(io->pos + size);
+  }
+  memcpy(io->out->data() + io->pos, data, size);
+  io->pos += size;
+  return size;
+}
+
+static toff_t tiff_seek_fn(thandle_t handle, toff_t offset, int whence) {
+  auto io = static_cast<tiff_vector_io_t *>(handle);
+  switch (whence) {
+  case SEEK_SET:
+    io->pos = offset;
+    break;
+  case SEEK_CUR:
+    io->pos += offset;
+    break;
+  case SEEK_END:
+    io->pos = io->out->size() + offset;
+    break;
+  }
+  return io->pos;
+}
+
+static int tiff_close_fn(thandle_t) { return 0; }
+
+static toff_t tiff_size_fn(thandle_t handle) {
+  return static_cast<tiff_vector_io_t *>(handle)->out->size();
+}
+
+static int tiff_map_fn(thandle_t, void **, toff_t *) { return 0; }
+
+static void tiff_unmap_fn(thandle_t, void *, toff_t) {}
+
+class tiff_encoder : public encoder {
+ public:
+  explicit tiff_encoder(const encode_options_t &options)
+      : _fallback("GTiff", options) {
+    static const std::unordered_map<string, int> compressions{{
+        {"NONE", COMPRESSION_NONE},
+        {"LZW", COMPRESSION_LZW},
+        {"DEFLATE", COMPRESSION_ADOBE_DEFLATE},
+        {"PACKBITS", COMPRESSION_PACKBITS},
+#ifdef COMPRESSION_ZSTD
+        {"ZSTD", COMPRESSION_ZSTD},
+#endif
+    }};
+    TIFFSetErrorHandler(tiff_error_fn);
+    const string compress = option_str(options, "COMPRESS", "NONE");
+    _predictor = option_int(options, "PREDICTOR", 1, 1, 3);
+    _zlevel = option_int(options, "ZLEVEL", 6, 1, 9);
+    _zstd_level = option_int(options, "ZSTD_LEVEL", 9, 1, 22);
+#ifndef COMPRESSION_ZSTD
+    // libtiff 4.0.10 之前没有 ZSTD，交给 GDAL 驱动编码
+    if (compress == "ZSTD") {
+      _compress = -1;
+      return;
+    }
+#endif
+    CHECK_F(compressions.count(compress), "unsupport COMPRESS %s",
+            compress.c_str());
+    _compress = compressions.at(compress);
+  }
+
+  void encode(const patch_t &patch, vector<unsigned char> &out) override {
+    if (_compress < 0) {
+      _fallback.encode(patch, out);
+      return;
+    }
+    int sample_format = 0;
+    switch (patch.data_type) {
+    case GDT_Byte:
+    case GDT_UInt16:
+    case GDT_UInt32:
+      sample_format = SAMPLEFORMAT_UINT;
+      break;
+    case GDT_Int16:
+    case GDT_Int32:
+      sample_format = SAMPLEFORMAT_INT;
+      break;
+    case GDT_Float32:
+    case GDT_Float64:
+      sample_format = SAMPLEFORMAT_IEEEFP;
+      break;
+    default:
+      _fallback.encode(patch, out);
+      return;
+    }
+    out.clear();
+    tiff_vector_io_t io{&out, 0};
+    TIFF *tif = TIFFClientOpen("patch", "w", &io, tiff_read_fn, tiff_write_fn,
+                               tiff_seek_fn, tiff_close_fn, tiff_size_fn,
+                               tiff_map_fn, tiff_unmap_fn);
+    CHECK_F(tif != nullptr, "TIFFClientOpen");
+    const bool rgb = patch.data_type == GDT_Byte && patch.nchannels >= 3;
+    TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, static_cast<uint32_t>(patch.width));
+    TIFFSetField(tif, TIFFTAG_IMAGELENGTH,
+                 static_cast<uint32_t>(patch.height));
+    TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, patch.nchannels);
+    TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE,
+                 static_cast<int>(patch.data_size * 8));
+    TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT, sample_format);
+    TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+    TIFFSetField(tif, TIFFTAG_PHOTOMETRIC,
+                 rgb ? PHOTOMETRIC_RGB : PHOTOMETRIC_MINISBLACK);
+    TIFFSetField(tif, TIFFTAG_COMPRESSION, _compress);
+    if (_compress == COMPRESSION_LZW ||
+        _compress == COMPRESSION_ADOBE_DEFLATE || is_zstd()) {
+      // 浮点预测只适用于浮点数据
+      const int predictor =
+          sample_format != SAMPLEFORMAT_IEEEFP && _predictor == 3 ? 1
+                                                                  : _predictor;
+      TIFFSetField(tif, TIFFTAG_PREDICTOR, predictor);
+    }
+    if (_compress == COMPRESSION_ADOBE_DEFLATE) {
+      TIFFSetField(tif, TIFFTAG_ZIPQUALITY, _zlevel);
+    }
+#ifdef COMPRESSION_ZSTD
+    if (_compress == COMPRESSION_ZSTD) {
+      TIFFSetField(tif, TIFFTAG_ZSTD_LEVEL, _zstd_level);
+    }
+#endif
+    const int nextra = patch.nchannels - (rgb ? 3 : 1);
+    if (nextra > 0) {
+      vector<uint16_t> extra(nextra, EXTRASAMPLE_UNSPECIFIED);
+      if (rgb) {
+        extra[0] = EXTRASAMPLE_UNASSALPHA;
+      }
+      TIFFSetField(tif, TIFFTAG_EXTRASAMPLES, static_cast<uint16_t>(nextra),
+                   extra.data());
+    }
+    TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(tif, 0));
+
+    const size_t line_size = patch.width * patch.nchannels * patch.data_size;
+    for (size_t y = 0; y < patch.height; y++) {
+      unsigned char *row =
+          const_cast<unsigned char *>(patch.data.data()) + y * line_size;
+      int ret = TIFFWriteScanline(tif, row, y, 0);
+      CHECK_F(ret >= 0, "TIFFWriteScanline row %ld", y);
+    }
+    TIFFClose(tif);
+  }
+
+ private:
+  bool is_zstd() const {
+#ifdef COMPRESSION_ZSTD
+    return _compress == COMPRESSION_ZSTD;
+#else
+    return false;
+#endif
+  }
+
+  gdal_encoder _fallback;
+  int _compress; // -1 时全部交给 _fallback
+  int _predictor;
+  int _zlevel;
+  int _zstd_level;
+};
+#endif
+
+static std::unique_ptr<encoder> make_encoder(const string &gdal_type,
+                                             const encode_options_t &options) {
+#ifdef WITH_LIBPNG
+  if (gdal_type == "PNG") {
+    return std::unique_ptr<encoder>(new png_encoder(options));
+  }
+#endif
+#ifdef WITH_LIBJPEG
+  if (gdal_type == "JPEG") {
+    return std::unique_ptr<encoder>(new jpeg_encoder(options));
+  }
+#endif
+#ifdef WITH_LIBTIFF
+  if (gdal_type == "GTiff") {
+    return std::unique_ptr<encoder>(new tiff_encoder(options));
+  }
+#endif
+  return std::unique_ptr<encoder>(new gdal_encoder(gdal_type, options));
+}
+
+encoder &get_encoder(const string &img_ext, const encode_options_t &options) {
+  thread_local std::unordered_map<string, std::unique_ptr<encoder>> encoders;
+  // 同一线程通常反复使用同一配置，命中上次的配置时不再拼接查找键
+  thread_local string last_ext;
+  thread_local encode_options_t last_options;
+  thread_local encoder *last = nullptr;
+  if (last != nullptr && last_ext == img_ext && last_options == options) {
+    return *last;
+  }
+  const string &gdal_type = get_gdal_image_type(img_ext);
+  CHECK_F(!gdal_type.empty(), "unsupport type %s ",
+          path::suffix(img_ext).c_str());
+  string key = gdal_type;
+  for (auto &option : options) {
+    key += " " + option.first + "=" + option.second;
+  }
+  auto &enc = encoders[key];
+  if (!enc) {
+    enc = make_encoder(gdal_type, options);
+  }
+  last_ext = img_ext;
+  last_options = options;
+  last = enc.get();
+  return *enc;
+}
+
+void write_file(const string &file, const vector<unsigned char> &data) {
+  write_file(file, reinterpret_cast<const char *>(data.data()), data.size());
+}
+
+void write_file(const string &file, const string &data) {
+  write_file(file, data.data(), data.size());
+}
+
+void write_file(const string &file, const char *data, const size_t &size) {
+  FILE *fp = fopen(file.c_str(), "wb");
+  CHECK_F(fp != nullptr, "fopen %s: %s", file.c_str(), strerror(errno));
+  size_t n = fwrite(data, 1, size, fp);
+  CHECK_F(n == size, "fwrite %s: %s", file.c_str(), strerror(errno));
+  // 缓冲区在 fclose 时才写出，磁盘已满等错误可能只在这里报告
+  CHECK_F(fclose(fp) == 0, "fclose %s: %s", file.c_str(), strerror(errno));
+}
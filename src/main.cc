@@ -5,18 +5,26 @@
 
 #include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
 #include <iterator>
-#include <list>
+#include <memory>
+#include <numeric>
+#include <sstream>
 #include <string>
 #include <vector>
 
+#include "cpu_utils.hpp"
 #include "dota_utils.h"
 #include "json.hpp"
 #include "loguru.hpp"
 #include "path_utils.hpp"
+#include "pipeline.h"
 #include "split_utils.h"
+#include "string_utils.hpp"
 #include "threadpool.hpp"
 
 using json = nlohmann::json;
@@ -58,6 +66,31 @@ json parse_json(int argc, char **argv) {
   return data;
 }
 
+// 用总耗时把代价标定为秒，输出预测误差和代价最大的几张图像
+void log_cost_model(const vector<std::pair<content_t, string>> &infos,
+                    const vector<double> &costs, const vector<double> &times) {
+  const double total_cost = std::accumulate(costs.begin(), costs.end(), 0.);
+  const double total_time = std::accumulate(times.begin(), times.end(), 0.);
+  if (total_cost <= 0) {
+    return;
+  }
+  const double scale = total_time / total_cost;
+  double error = 0;
+  std::stringstream ss;
+  ss << std::setiosflags(std::ios::fixed) << std::setprecision(3);
+  for (size_t i = 0; i < infos.size(); i++) {
+    const double predicted = costs[i] * scale;
+    error += std::fabs(predicted - times[i]);
+    if (i < 10) {
+      ss << "\n  " << infos[i].first.filename << ": predicted " << predicted
+         << "s, actual " << times[i] << "s";
+    }
+  }
+  LOG(INFO) << "cost model: mean absolute error " << std::setprecision(3)
+            << error / infos.size() << "s, the most expensive images:"
+            << ss.str() << endl;
+}
+
 void deal(const json &configs) {
   auto &&rates = configs.at("rates");
 
@@ -68,11 +101,13 @@ void deal(const json &configs) {
 
   vector<int> sizes(rows * cols, 0);
   vector<int> gaps(rows * cols, 0);
+  vector<int> out_sizes(rows * cols, 0);
 
   for (int i = 0; i < rows; i++) {
     for (int j = 0; j < cols; j++) {
       sizes[i * cols + j] = _sizes[j].get<int>() / rates[i].get<float>();
       gaps[i * cols + j] = _gaps[j].get<int>() / rates[i].get<float>();
+      out_sizes[i * cols + j] = _sizes[j].get<int>();
     }
   }
   const string save_dir = configs.at("save_dir");
@@ -84,61 +119,234 @@ void deal(const json &configs) {
   auto &&ann_dirs =
       configs.at("ann_dirs").is_null() ? json::array() : configs.at("ann_dirs");
 
-  int ret = mkdir(save_imgs.c_str(), 0774);
-  CHECK_F(ret != -1, "mkdir %s: %s", save_imgs.c_str(), strerror(errno));
+  // "files" 每个 patch 单独的文件，"tar" 写入每个线程各自滚动的 tar 分片，
+  // "sqlite" 写入一个 SQLite 数据库
+  const string output_mode = configs.value("output_mode", string("files"));
+  CHECK_F(output_mode == "files" || output_mode == "tar" ||
+              output_mode == "sqlite",
+          "unsupport output_mode %s", output_mode.c_str());
+  std::shared_ptr<tar_output> tar;
+  int ret;
+  if (output_mode == "tar") {
+    const string save_shards = save_dir + "shards/";
+    ret = mkdir(save_shards.c_str(), 0774);
+    CHECK_F(ret != -1, "mkdir %s: %s", save_shards.c_str(), strerror(errno));
+    const double shard_size = configs.value("shard_size", 1024.);
+    const int shard_count = configs.value("shard_count", 0);
+    CHECK_F(shard_size >= 0 && shard_count >= 0,
+            "shard_size and shard_count must be non-negative");
+    tar = std::make_shared<tar_output>(
+        save_shards, static_cast<size_t>(shard_size * (1 << 20)),
+        static_cast<size_t>(shard_count));
+  } else if (output_mode == "files") {
+    ret = mkdir(save_imgs.c_str(), 0774);
+    CHECK_F(ret != -1, "mkdir %s: %s", save_imgs.c_str(), strerror(errno));
+  }
 
-  if (!ann_dirs.empty()) {
+  // 标注输出格式，"dota" 为每个 patch 一个 txt 文件
+  const vector<string> ann_formats =
+      configs.value("ann_formats", vector<string>{"dota"});
+  const bool save_dota =
+      std::find(ann_formats.begin(), ann_formats.end(), "dota") !=
+      ann_formats.end();
+  if (!ann_dirs.empty() && save_dota && output_mode == "files") {
     ret = mkdir(save_files.c_str(), 0774);
     CHECK_F(ret != -1, "mkdir %s: %s", save_files.c_str(), strerror(errno));
   }
 
+  auto &dict = class_dict::instance();
+  if (configs.contains("classes")) {
+    auto &&classes = configs.at("classes");
+    if (classes.is_string()) {
+      dict.set_classes(classes.get<string>());
+    } else {
+      dict.set_classes(classes.get<vector<string>>());
+    }
+  }
+
+  split_cfg_t cfg;
+  cfg.sizes = sizes;
+  cfg.gaps = gaps;
+  cfg.out_sizes = out_sizes;
+  cfg.rescale = configs.value("rescale", false);
+  cfg.resample = configs.value("resample", string("auto"));
+  cfg.resample_engine = configs.value("resample_engine", string("gdal"));
+  CHECK_F(cfg.resample_engine == "gdal" || cfg.resample_engine == "builtin",
+          "unsupport resample_engine %s", cfg.resample_engine.c_str());
+  if (cfg.rescale) {
+    get_resample_alg(cfg.resample, 1.); // 提前检查配置
+  }
+  cfg.img_rate_thr = configs.at("img_rate_thr");
+  cfg.iof_thr = configs.at("iof_thr");
+  cfg.iof_kernel = configs.value("iof_kernel", string("batch"));
+  cfg.no_padding = configs.at("no_padding");
+  cfg.padding_value = configs.at("padding_value").get<vector<float>>();
+  cfg.padding_mode = configs.value("padding_mode", string("constant"));
+  CHECK_F(cfg.padding_mode == "constant" || cfg.padding_mode == "edge" ||
+              cfg.padding_mode == "reflect",
+          "unsupport padding_mode %s", cfg.padding_mode.c_str());
+  cfg.to_8bit = configs.value("to_8bit", string("none"));
+  CHECK_F(cfg.to_8bit == "none" || cfg.to_8bit == "minmax" ||
+              cfg.to_8bit == "percentile",
+          "unsupport to_8bit %s", cfg.to_8bit.c_str());
+  cfg.stretch_percent = configs.value("stretch_percent", vector<double>{2, 98});
+  CHECK_F(cfg.stretch_percent.size() == 2, "stretch_percent needs 2 values");
+  cfg.gamma = configs.value("gamma", 1.);
+  CHECK_F(cfg.gamma > 0, "gamma must be positive");
+  cfg.save_dir = save_imgs;
+  cfg.tar = tar;
+  const int ann_precision = configs.value("ann_precision", 0);
+  CHECK_F(ann_precision >= 0 && ann_precision <= 9,
+          "ann_precision must be in [0, 9]");
+  const int nthread = configs.at("nproc");
+  if (output_mode == "sqlite") {
+    // dota 标注存入数据库的 ann 列，不再单独写文件
+    cfg.db = std::make_shared<patch_db>(
+        save_dir + "patches.sqlite", configs.at("save_ext").get<string>(),
+        !ann_dirs.empty() && save_dota, ann_precision,
+        4 * static_cast<size_t>(std::max(nthread, 1)));
+  }
+  // 没有标注时不写标注文件
+  for (auto &format : ann_dirs.empty() ? vector<string>() : ann_formats) {
+    if (format == "dota" && cfg.db) {
+      continue;
+    }
+    const string path = format == "dota"    ? save_files
+                        : format == "jsonl" ? save_dir + "annotations.jsonl"
+                                            : save_dir + "annotations.json";
+    cfg.ann_sinks.emplace_back(
+        make_ann_sink(format, path, ann_precision, tar.get()));
+  }
+  cfg.img_ext = configs.at("save_ext");
+  cfg.save_options =
+      get_encode_preset(configs.value("save_preset", string("default")));
+  if (configs.contains("save_options")) {
+    for (auto &option : configs.at("save_options").items()) {
+      cfg.save_options[str::toupper(option.key())] =
+          option.value().is_string() ? option.value().get<string>()
+                                     : option.value().dump();
+    }
+  }
+  cfg.ignore_empty_prob = configs.value("ignore_empty_prob", 0.);
+  cfg.read_mode = configs.value("read_mode", string("window"));
+  CHECK_F(cfg.read_mode == "window" || cfg.read_mode == "block" ||
+              cfg.read_mode == "auto",
+          "unsupport read_mode %s", cfg.read_mode.c_str());
+  cfg.pyramid = configs.value("pyramid", false);
+  cfg.window_parallel = configs.value("window_parallel", false) && nthread > 1;
+
+  if (configs.value("pipeline", false)) {
+    vector<std::pair<string, string>> dirs;
+    for (size_t i = 0; i < img_dirs.size(); i++) {
+      dirs.emplace_back(img_dirs[i].get<string>(),
+                        ann_dirs.empty() ? "" : ann_dirs[i].get<string>());
+    }
+    LOG(INFO) << "start splitting images in pipeline!!!" << endl;
+    auto start_time = std::chrono::system_clock::now();
+    class_stats_t load_stats, split_stats;
+    size_t num_patches =
+        pipeline_split(dirs, cfg, nthread, load_stats, split_stats);
+    auto end_time = std::chrono::system_clock::now();
+    LOG(INFO) << "finish splitting images in "
+              << std::chrono::duration_cast<std::chrono::seconds>(end_time -
+                                                                  start_time)
+                     .count()
+              << "s!!!" << endl;
+    for (auto &sink : cfg.ann_sinks) {
+      sink->close();
+    }
+    if (cfg.tar) {
+      cfg.tar->close();
+    }
+    if (cfg.db) {
+      cfg.db->close();
+    }
+    LOG(INFO) << "splitting images " << num_patches << " in total" << endl;
+    log_class_stats("objects per class:", load_stats);
+    log_class_stats("objects per class in patches:", split_stats);
+    return;
+  }
+
   LOG(INFO) << "loading original data!!!" << endl;
 
-  std::list<std::pair<content_t, string>> infos; // 没有随机访问单节点
+  vector<std::pair<content_t, string>> infos;
   for (size_t i = 0; i < img_dirs.size(); i++) {
     auto &&img_dir = img_dirs[i].get<string>();
     const string ann_dir = ann_dirs.empty() ? "" : ann_dirs[i].get<string>();
 
     auto _infos = load_dota(img_dir, ann_dir, configs.at("nproc"));
     for (auto &&_info : _infos) {
-      infos.push_back(std::pair<content_t, string>{_info, img_dir});
+      infos.emplace_back(std::move(_info), img_dir);
     }
   }
 
+  class_stats_t load_stats;
+  for (auto &info : infos) {
+    count_classes(info.first.ann.labels, load_stats);
+  }
+  log_class_stats("objects per class:", load_stats);
+
+  // 按估计代价从大到小提交，避免大图最后才开始而拖长整体耗时
+  vector<double> costs(infos.size());
+  for (size_t i = 0; i < infos.size(); i++) {
+    costs[i] = estimate_cost(infos[i].first, cfg);
+  }
+  {
+    vector<size_t> order(infos.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+                     [&costs](const size_t &a, const size_t &b) {
+                       return costs[a] > costs[b];
+                     });
+    vector<std::pair<content_t, string>> _infos;
+    vector<double> _costs;
+    _infos.reserve(infos.size());
+    _costs.reserve(infos.size());
+    for (auto &i : order) {
+      _infos.push_back(std::move(infos[i]));
+      _costs.push_back(costs[i]);
+    }
+    infos.swap(_infos);
+    costs.swap(_costs);
+  }
+
   LOG(INFO) << "start splitting images!!!" << endl;
   auto start_time = std::chrono::system_clock::now();
 
   size_t prog = 0;
+  class_stats_t split_stats;
   std::mutex lock;
-  auto worker = [&configs, &sizes, &gaps, &save_files, &save_imgs, &prog, &lock,
-                 &infos](const std::pair<content_t, string> info) {
-    vector<float> padding_value(configs.at("padding_value").size(), 0);
-    int i = 0;
-    for (auto &value : configs.at("padding_value")) {
-      padding_value[i++] = value;
-    }
-    return single_split(
-        info, sizes, gaps, configs.at("img_rate_thr"), configs.at("iof_thr"),
-        configs.at("no_padding"), padding_value, save_imgs, save_files,
-        configs.at("save_ext"), configs.value("ignore_empty_prob", 0.),
-        infos.size(), prog, lock);
+  vector<double> times(infos.size(), 0);
+  auto worker = [&cfg, &prog, &split_stats, &lock, &infos,
+                 &times](const size_t &i) {
+    auto _start_time = std::chrono::steady_clock::now();
+    size_t num_patches =
+        single_split(infos[i], cfg, infos.size(), prog, split_stats, lock);
+    times[i] = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                             _start_time)
+                   .count();
+    return num_patches;
   };
 
-  const int nthread = configs.at("nproc");
-  vector<size_t> patch_infos;
-  patch_infos.reserve(infos.size());
+  size_t num_patches = 0;
   if (nthread > 1) {
-    std::threadpool pool(nthread);
-    auto _patch_infos = pool.map_container(worker, infos);
-    for (auto &_patch_info : _patch_infos) {
-      patch_infos.push_back(_patch_info.get());
-    }
+    num_patches = std::threadpool::instance(nthread).parallel_reduce(
+        0, infos.size(), 1, size_t(0), worker, std::plus<size_t>());
   } else {
-    for (auto &info : infos) {
-      patch_infos.push_back(worker(info));
+    for (size_t i = 0; i < infos.size(); i++) {
+      num_patches += worker(i);
     }
   }
 
+  for (auto &sink : cfg.ann_sinks) {
+    sink->close();
+  }
+  if (cfg.tar) {
+    cfg.tar->close();
+  }
+  if (cfg.db) {
+    cfg.db->close();
+  }
   auto end_time = std::chrono::system_clock::now();
   LOG(INFO) << "finish splitting images in "
             << std::chrono::duration_cast<std::chrono::seconds>(end_time -
@@ -146,14 +354,16 @@ void deal(const json &configs) {
                    .count()
             << "s!!!" << endl;
 
-  LOG(INFO) << "splitting images "
-            << std::accumulate(patch_infos.begin(), patch_infos.end(), 0UL)
-            << " in total" << endl;
+  LOG(INFO) << "splitting images " << num_patches << " in total" << endl;
+  log_class_stats("objects per class in patches:", split_stats);
+  log_cost_model(infos, costs, times);
 }
 
 int main(int argc, char **argv) {
   loguru::init(argc, argv);
   json configs = parse_json(argc, argv);
+  const string simd = configs.value("simd", string("auto"));
+  CHECK_F(cpu::set_simd_level(simd), "unsupport simd %s", simd.c_str());
   GDALAllRegister();
   LOG(INFO) << "\n" << configs.dump(2) << endl;
   deal(configs);
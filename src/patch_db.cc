@@ -0,0 +1,138 @@
+#include "patch_db.h"
+
+#ifdef WITH_SQLITE3
+#include <sqlite3.h>
+#endif
+
+#include "loguru.hpp"
+#include "path_utils.hpp"
+
+using std::string;
+using std::vector;
+
+// 每个事务插入的记录数
+static const size_t kBatchSize = 256;
+
+#ifdef WITH_SQLITE3
+patch_db::patch_db(const string &file, const string &img_ext,
+                   const bool &with_ann, const int &precision,
+                   const size_t &capacity)
+    : _file(file), _with_ann(with_ann), _precision(precision), _db(nullptr),
+      _records(capacity), _free_records(capacity) {
+  int ret = sqlite3_open(file.c_str(), &_db);
+  CHECK_F(ret == SQLITE_OK, "sqlite3_open %s: %s", file.c_str(),
+          sqlite3_errmsg(_db));
+  // 大页减少 BLOB 的溢出页链，输出中断后需要重新生成，不必每次提交都同步
+  exec("PRAGMA page_size = 65536");
+  exec("PRAGMA synchronous = OFF");
+  exec("CREATE TABLE metadata (name TEXT PRIMARY KEY, value TEXT)");
+  exec("CREATE TABLE patches (image_id TEXT NOT NULL, size INTEGER NOT NULL, "
+       "x INTEGER NOT NULL, y INTEGER NOT NULL, width INTEGER, height INTEGER, "
+       "data BLOB, ann BLOB, PRIMARY KEY (image_id, size, x, y))");
+  const string metadata =
+      "INSERT INTO metadata VALUES ('format', '" + path::suffix(img_ext) +
+      "'), ('ann_format', '" + (with_ann ? "dota" : "") +
+      "'), ('ann_precision', '" + std::to_string(precision) + "')";
+  exec(metadata.c_str());
+  _writer = std::thread(&patch_db::run, this);
+}
+
+void patch_db::exec(const char *sql) {
+  char *err = nullptr;
+  int ret = sqlite3_exec(_db, sql, nullptr, nullptr, &err);
+  CHECK_F(ret == SQLITE_OK, "sqlite3 %s (%s): %s", _file.c_str(), sql,
+          err != nullptr ? err : sqlite3_errmsg(_db));
+}
+
+void patch_db::run() {
+  sqlite3_stmt *stmt = nullptr;
+  // 同一个 patch 名的文件会被覆盖，这里保持一致
+  int ret = sqlite3_prepare_v2(
+      _db, "INSERT OR REPLACE INTO patches VALUES (?, ?, ?, ?, ?, ?, ?, ?)", -1,
+      &stmt, nullptr);
+  CHECK_F(ret == SQLITE_OK, "sqlite3_prepare_v2 %s: %s", _file.c_str(),
+          sqlite3_errmsg(_db));
+  std::unique_ptr<record_t> record;
+  size_t num_records = 0;
+  exec("BEGIN");
+  while (_records.pop(record)) {
+    sqlite3_bind_text(stmt, 1, record->image_id.c_str(),
+                      record->image_id.size(), SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, record->size);
+    sqlite3_bind_int64(stmt, 3, record->x);
+    sqlite3_bind_int64(stmt, 4, record->y);
+    sqlite3_bind_int64(stmt, 5, record->width);
+    sqlite3_bind_int64(stmt, 6, record->height);
+    sqlite3_bind_blob(stmt, 7, record->data.data(), record->data.size(),
+                      SQLITE_STATIC);
+    if (_with_ann) {
+      sqlite3_bind_blob(stmt, 8, record->ann.data(), record->ann.size(),
+                        SQLITE_STATIC);
+    } else {
+      sqlite3_bind_null(stmt, 8);
+    }
+    ret = sqlite3_step(stmt);
+    CHECK_F(ret == SQLITE_DONE, "sqlite3_step %s: %s", _file.c_str(),
+            sqlite3_errmsg(_db));
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    _free_records.try_push(record);
+    if (++num_records % kBatchSize == 0) {
+      exec("COMMIT");
+      exec("BEGIN");
+    }
+  }
+  exec("COMMIT");
+  sqlite3_finalize(stmt);
+}
+
+void patch_db::close() {
+  if (_db == nullptr) {
+    return;
+  }
+  _records.close();
+  _writer.join();
+  int ret = sqlite3_close(_db);
+  CHECK_F(ret == SQLITE_OK, "sqlite3_close %s: %s", _file.c_str(),
+          sqlite3_errmsg(_db));
+  _db = nullptr;
+}
+#else
+patch_db::patch_db(const string &file, const string &img_ext,
+                   const bool &with_ann, const int &precision,
+                   const size_t &capacity)
+    : _file(file), _with_ann(with_ann), _precision(precision), _db(nullptr),
+      _records(capacity), _free_records(capacity) {
+  ABORT_F("output_mode sqlite needs SQLite3, rebuild with it installed");
+}
+
+void patch_db::exec(const char *sql) {}
+
+void patch_db::run() {}
+
+void patch_db::close() {}
+#endif
+
+patch_db::~patch_db() { close(); }
+
+void patch_db::write(const string &image_id, const size_t &size,
+                     const size_t &x, const size_t &y,
+                     const vector<unsigned char> &data,
+                     const patch_ann_t &ann) {
+  std::unique_ptr<record_t> record;
+  if (!_free_records.try_pop(record)) {
+    record.reset(new record_t);
+  }
+  record->image_id = image_id;
+  record->size = size;
+  record->x = x;
+  record->y = y;
+  record->width = ann.width;
+  record->height = ann.height;
+  record->data.assign(data.begin(), data.end());
+  record->ann.clear();
+  if (_with_ann) {
+    append_dota_ann(record->ann, ann, _precision);
+  }
+  _records.push(std::move(record));
+}
@@ -0,0 +1,240 @@
+#include "pipeline.h"
+
+#include <gdal_priv.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <vector>
+
+#include "bounded_queue.hpp"
+#include "encode_utils.h"
+#include "loguru.hpp"
+#include "path_utils.hpp"
+#include "read_utils.h"
+#include "threadpool.hpp"
+
+using std::endl;
+using std::string;
+using std::vector;
+
+namespace {
+
+typedef struct {
+  string img_file;
+  string img_dir;
+  string ann_dir;
+} path_item_t;
+
+typedef struct {
+  content_t info;
+  string img_dir;
+} content_item_t;
+
+// 一张图像的全部窗口，最后一个 patch 写完后释放
+typedef struct {
+  content_t info;
+  string img_dir;
+  vector<window_t> plan;
+  std::atomic<size_t> remaining;
+} image_job_t;
+
+typedef struct {
+  std::shared_ptr<image_job_t> job;
+  size_t index;
+  patch_t patch;
+} patch_item_t;
+
+// 阶段在队列上阻塞，每个执行者独占一个工作线程: 规划 1 个、读取和写出各至少
+// 1 个，另有至少 1 个只写出的执行者保证 patches 队列总能被取空
+const int kMinPoolThreads = 4;
+
+// 调用线程等待所有阶段任务结束
+typedef struct {
+  std::mutex lock;
+  std::condition_variable cv;
+  int running = 0;
+} stage_latch_t;
+
+// 在线程池上提交 n 个执行 fn 的任务，最后一个结束的任务调用 done 关闭下游队列。
+// 不经过 future，异常与独立线程时一样直接终止进程，而不是让其它阶段一直阻塞
+void run_stage(std::threadpool &pool, const int &n,
+               const std::function<void()> &fn,
+               const std::function<void()> &done, stage_latch_t &latch) {
+  {
+    std::lock_guard<std::mutex> lg(latch.lock);
+    latch.running += n;
+  }
+  auto running = std::make_shared<std::atomic<int>>(n);
+  for (int i = 0; i < n; i++) {
+    pool.commit2([fn, done, running, &latch] {
+      fn();
+      if (--(*running) == 0) {
+        done();
+      }
+      std::lock_guard<std::mutex> lg(latch.lock);
+      if (--latch.running == 0) {
+        latch.cv.notify_all();
+      }
+    });
+  }
+}
+
+} // namespace
+
+size_t pipeline_split(const vector<std::pair<string, string>> &dirs,
+                      const split_cfg_t &cfg, const int &nthread,
+                      class_stats_t &load_stats, class_stats_t &split_stats) {
+  // 与其它模式共用进程内的线程池，阶段执行者的总数等于线程数，
+  // 遍历目录在调用线程上进行。解析标注的执行者结束后转为写出
+  auto &pool = std::threadpool::instance(std::max(nthread, kMinPoolThreads));
+  const int num_workers = pool.thrCount();
+  CHECK_F(num_workers >= kMinPoolThreads,
+          "pipeline needs at least %d pool threads, got %d", kMinPoolThreads,
+          num_workers);
+  const int num_readers = std::max(1, (num_workers - 1) / 2);
+  const int num_writers = num_workers - 1 - num_readers;
+  const int num_loaders =
+      std::min(std::max(1, num_workers / 4), num_writers - 1);
+
+  bounded_queue<path_item_t> paths(4 * num_loaders);
+  bounded_queue<content_item_t> contents(2 * num_loaders);
+  bounded_queue<std::shared_ptr<image_job_t>> jobs(num_readers);
+  bounded_queue<patch_item_t> patches(4 * num_writers);
+  // 写完的 patch 缓冲区回收给读取阶段
+  bounded_queue<patch_t> free_patches(4 * num_writers + num_readers);
+
+  std::mutex lock;
+  size_t prog = 0;
+  std::atomic<size_t> num_patches(0);
+
+  auto finish_image = [&lock, &prog](const image_job_t &job) {
+    std::lock_guard<std::mutex> lg(lock);
+    prog += 1;
+    LOG(INFO) << prog << " - "
+              << "filename: " << job.info.filename << " - "
+              << "width: " << job.info.width << " - "
+              << "height: " << job.info.height << " - "
+              << "objects: " << job.info.ann.labels.size() << " - "
+              << "patches: " << job.plan.size() << endl;
+  };
+
+  // 编码写出
+  auto write_patches = [&patches, &free_patches, &cfg, &lock, &split_stats,
+                        &num_patches, &finish_image] {
+    encoder &enc = get_encoder(cfg.img_ext, cfg.save_options);
+    vector<unsigned char> encoded;
+    class_stats_t stats;
+    patch_item_t item;
+    while (patches.pop(item)) {
+      auto &job = *item.job;
+      save_patch(job.info, job.plan[item.index], item.patch, cfg, enc, encoded,
+                 stats);
+      free_patches.try_push(item.patch);
+      num_patches++;
+      if (--job.remaining == 0) {
+        finish_image(job);
+      }
+      item.job.reset();
+    }
+    std::lock_guard<std::mutex> lg(lock);
+    merge_class_stats(stats, split_stats);
+  };
+
+  stage_latch_t latch;
+
+  // 读取图像尺寸并解析标注，最后一个结束的执行者关闭 contents 后
+  // 所有执行者转为写出，不让工作线程空闲
+  auto loaders_running = std::make_shared<std::atomic<int>>(num_loaders);
+  run_stage(
+      pool, num_loaders,
+      [&paths, &contents, &write_patches, loaders_running] {
+        path_item_t item;
+        while (paths.pop(item)) {
+          content_item_t content;
+          if (load_dota_single(item.img_file, item.ann_dir, content.info)) {
+            content.img_dir = item.img_dir;
+            contents.push(std::move(content));
+          }
+        }
+        if (--(*loaders_running) == 0) {
+          contents.close();
+        }
+        write_patches();
+      },
+      [] {}, latch);
+
+  // 规划窗口，单线程执行使得丢弃空窗口的随机序列可复现
+  run_stage(
+      pool, 1,
+      [&contents, &jobs, &cfg, &load_stats] {
+        content_item_t item;
+        while (contents.pop(item)) {
+          srand(4096);
+          auto job = std::make_shared<image_job_t>();
+          job->info = std::move(item.info);
+          job->img_dir = std::move(item.img_dir);
+          job->plan = plan_windows(job->info, cfg);
+          job->remaining = job->plan.size();
+          count_classes(job->info.ann.labels, load_stats);
+          jobs.push(std::move(job));
+        }
+      },
+      [&jobs] { jobs.close(); }, latch);
+
+  // 读取像素
+  run_stage(
+      pool, num_readers,
+      [&jobs, &patches, &free_patches, &cfg, &finish_image, &num_readers] {
+        std::shared_ptr<image_job_t> job;
+        while (jobs.pop(job)) {
+          if (job->plan.empty()) {
+            finish_image(*job);
+            continue;
+          }
+          auto img_file = job->img_dir + job->info.filename;
+          GDALDataset *dataset = static_cast<GDALDataset *>(
+              GDALOpen(img_file.c_str(), GA_ReadOnly));
+          CHECK_F(dataset != nullptr, "can't open %s", img_file.c_str());
+          block_reader reader(dataset, cfg.pyramid && cfg.rescale);
+          auto &&converter = make_depth_converter(dataset, cfg);
+          block_reader *_reader =
+              use_block_reader(job->info, cfg, num_readers) ? &reader
+                                                            : nullptr;
+          for (size_t i = 0; i < job->plan.size(); i++) {
+            patch_item_t item{job, i};
+            free_patches.try_pop(item.patch);
+            read_patch(job->info, job->plan[i], cfg, dataset, _reader,
+                       item.patch, converter.get());
+            patches.push(std::move(item));
+          }
+          GDALClose(static_cast<GDALDatasetH>(dataset));
+        }
+      },
+      [&patches] { patches.close(); }, latch);
+
+  // 只写出的执行者
+  run_stage(pool, num_writers - num_loaders, write_patches, [] {}, latch);
+
+  // 遍历目录
+  for (auto &dir : dirs) {
+    for (auto &img_file : path::glob(dir.first + "*")) {
+      paths.push(path_item_t{img_file, dir.first, dir.second});
+    }
+  }
+  paths.close();
+
+  std::unique_lock<std::mutex> ul(latch.lock);
+  latch.cv.wait(ul, [&latch] { return latch.running == 0; });
+  // 与 load_dota 一致，报告被 classes 过滤的对象数
+  const size_t filtered = take_num_filtered();
+  if (filtered > 0) {
+    LOG(INFO) << "ignore " << filtered << " objects not in classes" << endl;
+  }
+  return num_patches;
+}
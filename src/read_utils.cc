@@ -0,0 +1,381 @@
+#include "read_utils.h"
+
+#include <gdal_priv.h>
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include "loguru.hpp"
+#include "pixel_dispatch.hpp"
+
+using std::string;
+using std::vector;
+
+void init_patch(patch_t &patch, const size_t &width, const size_t &height,
+                const int &nchannels, const GDALDataType &data_type) {
+  patch.width = width;
+  patch.height = height;
+  patch.nchannels = nchannels;
+  patch.data_type = data_type;
+  patch.data_size = GDALGetDataTypeSizeBytes(data_type);
+  patch.data.resize(width * height * nchannels * patch.data_size);
+}
+
+// 从 dst 处已有的一个像素开始，按倍增拷贝铺满 count 个像素，
+// 每次 memcpy 都是大块连续拷贝
+static void replicate_pixel(unsigned char *dst, const size_t &pixel_size,
+                            const size_t &count) {
+  const size_t total = count * pixel_size;
+  size_t filled = std::min(pixel_size, total);
+  while (filled < total) {
+    const size_t n = std::min(filled, total - filled);
+    memcpy(dst + filled, dst, n);
+    filled += n;
+  }
+}
+
+// 以 0 和 n - 1 为轴的镜像下标 (不重复边缘)，超出时来回折返
+static size_t reflect_index(const size_t &i, const size_t &n) {
+  if (n == 1) {
+    return 0;
+  }
+  const size_t period = 2 * (n - 1);
+  const size_t k = i % period;
+  return k < n ? k : period - k;
+}
+
+// 右侧边框: 每行的 [x_num, width) 复制边缘像素或镜像像素
+template <typename T, int C>
+struct pad_right {
+  static void run(unsigned char *data, const size_t &line_size,
+                  const size_t &width, const size_t &x_num,
+                  const size_t &y_num, const int &nchannels,
+                  const bool &reflect) {
+    const int nc = pixel::channels<C>::get(nchannels);
+    for (size_t y = 0; y < y_num; y++) {
+      T *row = reinterpret_cast<T *>(data + y * line_size);
+      for (size_t x = x_num; x < width; x++) {
+        const size_t src_x = reflect ? reflect_index(x, x_num) : x_num - 1;
+        for (int c = 0; c < nc; c++) {
+          row[x * nc + c] = row[src_x * nc + c];
+        }
+      }
+    }
+  }
+};
+
+void pad_patch(patch_t &patch, const size_t &x_num, const size_t &y_num,
+               const string &mode, const vector<float> &padding_value) {
+  const size_t width = patch.width, height = patch.height;
+  if ((x_num >= width && y_num >= height) || width == 0 || height == 0) {
+    return;
+  }
+  const size_t pixel_size = patch.nchannels * patch.data_size;
+  const size_t line_size = width * pixel_size;
+  unsigned char *data = patch.data.data();
+  if (mode == "constant" || x_num == 0 || y_num == 0) {
+    vector<unsigned char> pixel(pixel_size);
+    for (int j = 0; j < patch.nchannels; j++) {
+      const int pi = padding_value.size() - j % padding_value.size() - 1;
+      const double value = padding_value[pi];
+      GDALCopyWords(&value, GDT_Float64, 0, pixel.data() + j * patch.data_size,
+                    patch.data_type, 0, 1);
+    }
+    if (x_num < width) {
+      for (size_t y = 0; y < y_num; y++) {
+        unsigned char *dst = data + y * line_size + x_num * pixel_size;
+        memcpy(dst, pixel.data(), pixel_size);
+        replicate_pixel(dst, pixel_size, width - x_num);
+      }
+    }
+    if (y_num < height) {
+      unsigned char *dst = data + y_num * line_size;
+      memcpy(dst, pixel.data(), pixel_size);
+      replicate_pixel(dst, pixel_size, (height - y_num) * width);
+    }
+    return;
+  }
+  CHECK_F(mode == "edge" || mode == "reflect", "unsupport padding_mode %s",
+          mode.c_str());
+  const bool edge = mode == "edge";
+  if (x_num < width) {
+    // 其它数据类型只拷贝像素，按 pixel_size 个单字节波段处理
+    auto pad = pixel::select<pad_right>(patch.data_type, patch.nchannels);
+    const int nchannels = pad != nullptr ? patch.nchannels : pixel_size;
+    if (pad == nullptr) {
+      pad = pixel::select<pad_right>(GDT_Byte, nchannels);
+    }
+    pad(data, line_size, width, x_num, y_num, nchannels, !edge);
+  }
+  // 下方边框整行复制已经补齐右侧的源行
+  for (size_t y = y_num; y < height; y++) {
+    const size_t src_y = edge ? y_num - 1 : reflect_index(y, y_num);
+    memcpy(data + y * line_size, data + src_y * line_size, line_size);
+  }
+}
+
+void read_window(GDALDataset *dataset, const size_t &x_start,
+                 const size_t &y_start, const size_t &x_num,
+                 const size_t &y_num, patch_t &patch) {
+  read_window(dataset, x_start, y_start, x_num, y_num, patch, x_num, y_num,
+              GRIORA_NearestNeighbour);
+}
+
+void read_window(GDALDataset *dataset, const size_t &x_start,
+                 const size_t &y_start, const size_t &x_num,
+                 const size_t &y_num, patch_t &patch, const size_t &buf_x,
+                 const size_t &buf_y, const GDALRIOResampleAlg &alg) {
+  vector<int> band_map(patch.nchannels);
+  std::iota(band_map.begin(), band_map.end(), 1);
+  const size_t pixel_size = patch.nchannels * patch.data_size;
+  GDALRasterIOExtraArg extra_arg;
+  INIT_RASTERIO_EXTRA_ARG(extra_arg);
+  extra_arg.eResampleAlg = alg;
+  CPLErr ret = dataset->RasterIO(
+      GF_Read, x_start, y_start, x_num, y_num, patch.data.data(), buf_x, buf_y,
+      patch.data_type, patch.nchannels, band_map.data(), pixel_size,
+      pixel_size * patch.width, patch.data_size, &extra_arg);
+  CHECK_F(ret < CE_Failure, "RasterIO [%ld %ld %ld %ld]: %s", x_start, y_start,
+          x_num, y_num, CPLGetLastErrorMsg());
+}
+
+GDALRIOResampleAlg get_resample_alg(const string &name, const double &scale) {
+  static const std::map<string, GDALRIOResampleAlg> algs{
+      {"nearest", GRIORA_NearestNeighbour},
+      {"bilinear", GRIORA_Bilinear},
+      {"cubic", GRIORA_Cubic},
+      {"cubicspline", GRIORA_CubicSpline},
+      {"lanczos", GRIORA_Lanczos},
+      {"average", GRIORA_Average},
+      {"mode", GRIORA_Mode},
+      {"gauss", GRIORA_Gauss}};
+  if (name == "auto") {
+    return scale < 1 ? GRIORA_Average : GRIORA_Bilinear;
+  }
+  auto it = algs.find(name);
+  CHECK_F(it != algs.end(), "unsupport resample %s", name.c_str());
+  return it->second;
+}
+
+GDALDataset *wrap_patch(const patch_t &patch) {
+  return wrap_buffer(patch.data.data(), patch.width, patch.height,
+                     patch.nchannels, patch.data_type,
+                     patch.width * patch.nchannels * patch.data_size);
+}
+
+GDALDataset *wrap_buffer(const unsigned char *data, const size_t &width,
+                         const size_t &height, const int &nchannels,
+                         const GDALDataType &data_type,
+                         const size_t &line_size) {
+  GDALDriver *mem_driver = GetGDALDriverManager()->GetDriverByName("MEM");
+  CHECK_F(mem_driver != nullptr, "GetDriverByName \"MEM\": %s",
+          CPLGetLastErrorMsg());
+  GDALDataset *mem_dataset =
+      mem_driver->Create("", width, height, 0, data_type, nullptr);
+  CHECK_F(mem_dataset != nullptr, "Create MEM: %s", CPLGetLastErrorMsg());
+  const size_t data_size = GDALGetDataTypeSizeBytes(data_type);
+  const size_t pixel_size = nchannels * data_size;
+  for (int j = 0; j < nchannels; j++) {
+    char pointer[64] = {0};
+    unsigned char *band_data =
+        const_cast<unsigned char *>(data) + j * data_size;
+    int n = CPLPrintPointer(pointer, band_data, sizeof(pointer));
+    pointer[n] = 0;
+    char **options = nullptr;
+    options = CSLSetNameValue(options, "DATAPOINTER", pointer);
+    options = CSLSetNameValue(options, "PIXELOFFSET",
+                              std::to_string(pixel_size).c_str());
+    options = CSLSetNameValue(options, "LINEOFFSET",
+                              std::to_string(line_size).c_str());
+    CPLErr ret = mem_dataset->AddBand(data_type, options);
+    CSLDestroy(options);
+    CHECK_F(ret < CE_Failure, "AddBand: %s", CPLGetLastErrorMsg());
+  }
+  return mem_dataset;
+}
+
+dataset_pool::dataset_pool(const string &file) : _file(file) {}
+
+dataset_pool::~dataset_pool() {
+  for (auto &dataset : _all) {
+    GDALClose(static_cast<GDALDatasetH>(dataset));
+  }
+}
+
+GDALDataset *dataset_pool::acquire() {
+  {
+    std::lock_guard<std::mutex> lg(_lock);
+    if (!_free.empty()) {
+      GDALDataset *dataset = _free.back();
+      _free.pop_back();
+      return dataset;
+    }
+  }
+  GDALDataset *dataset =
+      static_cast<GDALDataset *>(GDALOpen(_file.c_str(), GA_ReadOnly));
+  CHECK_F(dataset != nullptr, "can't open %s", _file.c_str());
+  std::lock_guard<std::mutex> lg(_lock);
+  _all.push_back(dataset);
+  return dataset;
+}
+
+void dataset_pool::release(GDALDataset *dataset) {
+  std::lock_guard<std::mutex> lg(_lock);
+  _free.push_back(dataset);
+}
+
+// 两行 (图像最后一行为奇数时一行) 原图像素按 2x2 取平均，四舍五入
+template <typename T, int C>
+struct downsample_row {
+  static void run(const unsigned char *row0, const unsigned char *row1,
+                  const size_t &width, const int &nchannels,
+                  unsigned char *dst) {
+    const int nc = pixel::channels<C>::get(nchannels);
+    const T *src[2] = {reinterpret_cast<const T *>(row0),
+                       reinterpret_cast<const T *>(row1)};
+    const int nrows = row1 != nullptr ? 2 : 1;
+    T *out = reinterpret_cast<T *>(dst);
+    for (size_t x = 0; 2 * x < width; x++) {
+      const int ncols = 2 * x + 1 < width ? 2 : 1;
+      const unsigned int count = nrows * ncols;
+      for (int c = 0; c < nc; c++) {
+        unsigned int sum = 0;
+        for (int r = 0; r < nrows; r++) {
+          for (int k = 0; k < ncols; k++) {
+            sum += src[r][(2 * x + k) * nc + c];
+          }
+        }
+        out[x * nc + c] = static_cast<T>((sum + count / 2) / count);
+      }
+    }
+  }
+};
+
+block_reader::block_reader(GDALDataset *dataset, const bool &pyramid)
+    : _dataset(dataset), _row_start(0), _row_stop(0), _half_start(0),
+      _half_stop(0) {
+  _width = dataset->GetRasterXSize();
+  _height = dataset->GetRasterYSize();
+  _nchannels = dataset->GetRasterCount();
+  auto band = dataset->GetRasterBand(1);
+  _data_type = band->GetRasterDataType();
+  _pixel_size = _nchannels * GDALGetDataTypeSizeBytes(_data_type);
+  int block_x = 0, block_y = 0;
+  band->GetBlockSize(&block_x, &block_y);
+  _block_height = std::max(block_y, 1);
+  _pyramid = pyramid && (_data_type == GDT_Byte || _data_type == GDT_UInt16);
+  _downsample = _data_type == GDT_Byte
+                    ? pixel::select_channels<pixel::bind_type<
+                          downsample_row, unsigned char>::template type>(
+                          _nchannels)
+                    : pixel::select_channels<pixel::bind_type<
+                          downsample_row, unsigned short>::template type>(
+                          _nchannels);
+  _half_width = (_width + 1) / 2;
+}
+
+void block_reader::advance(const size_t &y_start, const size_t &y_stop) {
+  const size_t line_size = _width * _pixel_size;
+  // 降采样层按偶数行成对计算，条带从偶数行开始
+  const size_t row_start =
+      (_pyramid ? y_start & ~static_cast<size_t>(1) : y_start) /
+      _block_height * _block_height;
+  const size_t row_stop = std::min(
+      (y_stop + _block_height - 1) / _block_height * _block_height, _height);
+
+  // 保留与上一条带重叠的行，只解码新增的块行
+  size_t keep = 0;
+  if (_row_stop > row_start) {
+    keep = _row_stop - row_start;
+    memmove(_strip.data(), _strip.data() + (row_start - _row_start) * line_size,
+            keep * line_size);
+  }
+  const size_t rows = row_stop - row_start;
+  if (_strip.size() < rows * line_size) {
+    _strip.resize(rows * line_size);
+  }
+
+  const size_t read_rows = rows - keep;
+  CPLErr ret = _dataset->RasterIO(
+      GF_Read, 0, row_start + keep, _width, read_rows,
+      _strip.data() + keep * line_size, _width, read_rows, _data_type,
+      _nchannels, nullptr, _pixel_size, line_size,
+      GDALGetDataTypeSizeBytes(_data_type));
+  CHECK_F(ret < CE_Failure, "RasterIO rows [%ld %ld): %s", row_start + keep,
+          row_stop, CPLGetLastErrorMsg());
+
+  _row_start = row_start;
+  _row_stop = row_stop;
+}
+
+void block_reader::advance_half(const size_t &y_start, const size_t &y_stop) {
+  const size_t line_size = _width * _pixel_size;
+  const size_t half_line_size = _half_width * _pixel_size;
+  size_t keep = 0;
+  if (_half_start <= y_start && _half_stop > y_start) {
+    keep = _half_stop - y_start;
+    memmove(_half.data(), _half.data() + (y_start - _half_start) * half_line_size,
+            keep * half_line_size);
+  }
+  if (_half.size() < (y_stop - y_start) * half_line_size) {
+    _half.resize((y_stop - y_start) * half_line_size);
+  }
+  for (size_t y = y_start + keep; y < y_stop; y++) {
+    const unsigned char *row0 = _strip.data() + (2 * y - _row_start) * line_size;
+    const unsigned char *row1 = 2 * y + 1 < _height ? row0 + line_size : nullptr;
+    unsigned char *dst = _half.data() + (y - y_start) * half_line_size;
+    _downsample(row0, row1, _width, _nchannels, dst);
+  }
+  _half_start = y_start;
+  _half_stop = y_stop;
+}
+
+image_view_t block_reader::view(const size_t &x_start, const size_t &y_start,
+                                const size_t &x_num, const size_t &y_num,
+                                const int &level) {
+  if (level == 0) {
+    CHECK_F(y_start >= _row_start, "windows must be read top to bottom");
+    const size_t y_stop = y_start + y_num;
+    if (y_stop > _row_stop) {
+      advance(y_start, y_stop);
+    }
+    const size_t line_size = _width * _pixel_size;
+    return image_view_t{_strip.data() + (y_start - _row_start) * line_size +
+                            x_start * _pixel_size,
+                        x_num, y_num, line_size};
+  }
+  CHECK_F(_pyramid && level == 1, "unsupport pyramid level %d", level);
+  const size_t half_x_start = x_start / 2, half_y_start = y_start / 2;
+  const size_t half_x_stop = std::min((x_start + x_num + 1) / 2, _half_width);
+  const size_t half_y_stop = (y_start + y_num + 1) / 2;
+  CHECK_F(half_y_start >= _half_start && 2 * half_y_start >= _row_start,
+          "windows must be read top to bottom");
+  if (half_y_stop > _half_stop) {
+    const size_t y_stop = std::min(2 * half_y_stop, _height);
+    if (y_stop > _row_stop) {
+      advance(2 * half_y_start, y_stop);
+    }
+    advance_half(half_y_start, half_y_stop);
+  }
+  const size_t half_line_size = _half_width * _pixel_size;
+  return image_view_t{_half.data() +
+                          (half_y_start - _half_start) * half_line_size +
+                          half_x_start * _pixel_size,
+                      half_x_stop - half_x_start, half_y_stop - half_y_start,
+                      half_line_size};
+}
+
+void block_reader::read(const size_t &x_start, const size_t &y_start,
+                        const size_t &x_num, const size_t &y_num,
+                        patch_t &patch) {
+  const image_view_t &&src = view(x_start, y_start, x_num, y_num);
+  const size_t patch_line_size = patch.width * _pixel_size;
+  for (size_t y = 0; y < y_num; y++) {
+    memcpy(patch.data.data() + y * patch_line_size, src.data + y * src.line_size,
+           x_num * _pixel_size);
+  }
+}
@@ -0,0 +1,85 @@
+#include "rect_iof.h"
+
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "cpu_utils.hpp"
+#include "rect_iof_kernel.hpp"
+
+struct vec_scalar {
+  typedef double type;
+  static const size_t width = 1;
+  static type set1(const double &v) { return v; }
+  static type load(const double *p) { return *p; }
+  static void store(double *p, const type &v) { *p = v; }
+  static type add(const type &a, const type &b) { return a + b; }
+  static type sub(const type &a, const type &b) { return a - b; }
+  static type mul(const type &a, const type &b) { return a * b; }
+  // 标量版本由 select 保证不会用到除零的结果
+  static type div(const type &a, const type &b) { return b == 0 ? 0 : a / b; }
+  static type min(const type &a, const type &b) { return a < b ? a : b; }
+  static type max(const type &a, const type &b) { return a > b ? a : b; }
+  static type abs(const type &a) { return std::fabs(a); }
+  static type eq(const type &a, const type &b) { return a == b ? 1 : 0; }
+  static type gt(const type &a, const type &b) { return a > b ? 1 : 0; }
+  static type select(const type &mask, const type &a, const type &b) {
+    return mask != 0 ? a : b;
+  }
+};
+
+void rect_iof_batch_scalar(const quads_t &quads, const size_t &begin,
+                           const double &x1, const double &y1,
+                           const double &x2, const double &y2, double *iofs) {
+  rect_iof::batch<vec_scalar>(quads, begin, x1, y1, x2, y2, iofs);
+}
+
+#if defined(__SSE2__)
+struct vec_sse2 {
+  typedef __m128d type;
+  static const size_t width = 2;
+  static type set1(const double &v) { return _mm_set1_pd(v); }
+  static type load(const double *p) { return _mm_loadu_pd(p); }
+  static void store(double *p, const type &v) { _mm_storeu_pd(p, v); }
+  static type add(const type &a, const type &b) { return _mm_add_pd(a, b); }
+  static type sub(const type &a, const type &b) { return _mm_sub_pd(a, b); }
+  static type mul(const type &a, const type &b) { return _mm_mul_pd(a, b); }
+  static type div(const type &a, const type &b) { return _mm_div_pd(a, b); }
+  static type min(const type &a, const type &b) { return _mm_min_pd(a, b); }
+  static type max(const type &a, const type &b) { return _mm_max_pd(a, b); }
+  static type abs(const type &a) { return _mm_andnot_pd(_mm_set1_pd(-0.), a); }
+  static type eq(const type &a, const type &b) { return _mm_cmpeq_pd(a, b); }
+  static type gt(const type &a, const type &b) { return _mm_cmpgt_pd(a, b); }
+  static type select(const type &mask, const type &a, const type &b) {
+    return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));
+  }
+};
+
+void rect_iof_batch_sse2(const quads_t &quads, const size_t &begin,
+                         const double &x1, const double &y1, const double &x2,
+                         const double &y2, double *iofs) {
+  const size_t i =
+      rect_iof::batch<vec_sse2>(quads, begin, x1, y1, x2, y2, iofs);
+  rect_iof_batch_scalar(quads, i, x1, y1, x2, y2, iofs);
+}
+#endif
+
+void rect_iof_batch(const quads_t &quads, const double &x1, const double &y1,
+                    const double &x2, const double &y2, double *iofs) {
+  switch (cpu::simd_level()) {
+#if defined(__x86_64__) || defined(__i386__)
+  case cpu::kAVX2:
+    rect_iof_batch_avx2(quads, 0, x1, y1, x2, y2, iofs);
+    return;
+#endif
+#if defined(__SSE2__)
+  case cpu::kSSE2:
+    rect_iof_batch_sse2(quads, 0, x1, y1, x2, y2, iofs);
+    return;
+#endif
+  default:
+    rect_iof_batch_scalar(quads, 0, x1, y1, x2, y2, iofs);
+  }
+}
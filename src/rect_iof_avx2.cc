@@ -0,0 +1,53 @@
+// 本文件以 -mavx2 编译 (见 CMakeLists.txt)，只在 cpu::simd_level() 为 AVX2 时调用
+#include "rect_iof.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+#include "rect_iof_kernel.hpp"
+
+struct vec_avx2 {
+  typedef __m256d type;
+  static const size_t width = 4;
+  static type set1(const double &v) { return _mm256_set1_pd(v); }
+  static type load(const double *p) { return _mm256_loadu_pd(p); }
+  static void store(double *p, const type &v) { _mm256_storeu_pd(p, v); }
+  static type add(const type &a, const type &b) { return _mm256_add_pd(a, b); }
+  static type sub(const type &a, const type &b) { return _mm256_sub_pd(a, b); }
+  static type mul(const type &a, const type &b) { return _mm256_mul_pd(a, b); }
+  static type div(const type &a, const type &b) { return _mm256_div_pd(a, b); }
+  static type min(const type &a, const type &b) { return _mm256_min_pd(a, b); }
+  static type max(const type &a, const type &b) { return _mm256_max_pd(a, b); }
+  static type abs(const type &a) {
+    return _mm256_andnot_pd(_mm256_set1_pd(-0.), a);
+  }
+  static type eq(const type &a, const type &b) {
+    return _mm256_cmp_pd(a, b, _CMP_EQ_OQ);
+  }
+  static type gt(const type &a, const type &b) {
+    return _mm256_cmp_pd(a, b, _CMP_GT_OQ);
+  }
+  static type select(const type &mask, const type &a, const type &b) {
+    return _mm256_blendv_pd(b, a, mask);
+  }
+};
+
+void rect_iof_batch_avx2(const quads_t &quads, const size_t &begin,
+                         const double &x1, const double &y1, const double &x2,
+                         const double &y2, double *iofs) {
+  const size_t i =
+      rect_iof::batch<vec_avx2>(quads, begin, x1, y1, x2, y2, iofs);
+  rect_iof_batch_sse2(quads, i, x1, y1, x2, y2, iofs);
+}
+#else
+// 编译器不支持 AVX2 时退回 SSE2/标量实现
+void rect_iof_batch_avx2(const quads_t &quads, const size_t &begin,
+                         const double &x1, const double &y1, const double &x2,
+                         const double &y2, double *iofs) {
+#if defined(__SSE2__)
+  rect_iof_batch_sse2(quads, begin, x1, y1, x2, y2, iofs);
+#else
+  rect_iof_batch_scalar(quads, begin, x1, y1, x2, y2, iofs);
+#endif
+}
+#endif
@@ -0,0 +1,243 @@
+#include "resample.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "cpu_utils.hpp"
+#include "loguru.hpp"
+#include "pixel_dispatch.hpp"
+
+using std::string;
+using std::vector;
+
+// 由每个输出坐标的 (源坐标, 权重) 列表生成等长的权重表，保证不越界
+static resample_taps_t
+make_taps(const size_t &src_size,
+          const vector<vector<std::pair<int, float>>> &entries) {
+  resample_taps_t taps;
+  taps.taps = 1;
+  for (auto &entry : entries) {
+    const int lo = entry.front().first, hi = entry.back().first;
+    taps.taps = std::max(taps.taps, hi - lo + 1);
+  }
+  taps.start.resize(entries.size());
+  taps.weights.assign(entries.size() * taps.taps, 0.f);
+  for (size_t i = 0; i < entries.size(); i++) {
+    int start = std::min(entries[i].front().first,
+                         static_cast<int>(src_size) - taps.taps);
+    taps.start[i] = start;
+    for (auto &tap : entries[i]) {
+      taps.weights[i * taps.taps + tap.first - start] += tap.second;
+    }
+  }
+  return taps;
+}
+
+resample_taps_t area_taps(const size_t &src_size, const size_t &dst_size) {
+  const double ratio = static_cast<double>(src_size) / dst_size;
+  vector<vector<std::pair<int, float>>> entries(dst_size);
+  for (size_t i = 0; i < dst_size; i++) {
+    const double lo = i * ratio;
+    const double hi = std::min((i + 1) * ratio, static_cast<double>(src_size));
+    for (int j = static_cast<int>(lo); j < hi; j++) {
+      const double overlap =
+          std::min<double>(j + 1, hi) - std::max<double>(j, lo);
+      if (overlap > 0) {
+        entries[i].emplace_back(j, static_cast<float>(overlap / (hi - lo)));
+      }
+    }
+  }
+  return make_taps(src_size, entries);
+}
+
+resample_taps_t bilinear_taps(const size_t &src_size, const size_t &dst_size) {
+  const double ratio = static_cast<double>(src_size) / dst_size;
+  const int last = static_cast<int>(src_size) - 1;
+  vector<vector<std::pair<int, float>>> entries(dst_size);
+  for (size_t i = 0; i < dst_size; i++) {
+    const double center = (i + 0.5) * ratio - 0.5;
+    const int j = static_cast<int>(std::floor(center));
+    const float f = static_cast<float>(center - j);
+    if (j < 0) {
+      entries[i].emplace_back(0, 1.f);
+    } else if (j >= last) {
+      entries[i].emplace_back(last, 1.f);
+    } else {
+      entries[i].emplace_back(j, 1.f - f);
+      entries[i].emplace_back(j + 1, f);
+    }
+  }
+  return make_taps(src_size, entries);
+}
+
+void accumulate_row_u8_scalar(const unsigned char *row, const float &w,
+                              float *acc, const size_t &n) {
+  for (size_t i = 0; i < n; i++) {
+    acc[i] += w * row[i];
+  }
+}
+
+void accumulate_row_u16_scalar(const unsigned short *row, const float &w,
+                               float *acc, const size_t &n) {
+  for (size_t i = 0; i < n; i++) {
+    acc[i] += w * row[i];
+  }
+}
+
+#if defined(__SSE2__)
+void accumulate_row_u8_sse2(const unsigned char *row, const float &w,
+                            float *acc, const size_t &n) {
+  const __m128 _w = _mm_set1_ps(w);
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i));
+    const __m128i lo = _mm_unpacklo_epi8(v, zero);
+    const __m128i hi = _mm_unpackhi_epi8(v, zero);
+    const __m128i v32[4] = {
+        _mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+        _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero)};
+    for (int k = 0; k < 4; k++) {
+      float *p = acc + i + 4 * k;
+      _mm_storeu_ps(p, _mm_add_ps(_mm_loadu_ps(p),
+                                  _mm_mul_ps(_w, _mm_cvtepi32_ps(v32[k]))));
+    }
+  }
+  accumulate_row_u8_scalar(row + i, w, acc + i, n - i);
+}
+
+void accumulate_row_u16_sse2(const unsigned short *row, const float &w,
+                             float *acc, const size_t &n) {
+  const __m128 _w = _mm_set1_ps(w);
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i));
+    const __m128i v32[2] = {_mm_unpacklo_epi16(v, zero),
+                            _mm_unpackhi_epi16(v, zero)};
+    for (int k = 0; k < 2; k++) {
+      float *p = acc + i + 4 * k;
+      _mm_storeu_ps(p, _mm_add_ps(_mm_loadu_ps(p),
+                                  _mm_mul_ps(_w, _mm_cvtepi32_ps(v32[k]))));
+    }
+  }
+  accumulate_row_u16_scalar(row + i, w, acc + i, n - i);
+}
+#endif
+
+template <typename T>
+static void accumulate_row(const T *row, const float &w, float *acc,
+                           const size_t &n);
+
+template <>
+void accumulate_row<unsigned char>(const unsigned char *row, const float &w,
+                                   float *acc, const size_t &n) {
+  switch (cpu::simd_level()) {
+#if defined(__x86_64__) || defined(__i386__)
+  case cpu::kAVX2:
+    accumulate_row_u8_avx2(row, w, acc, n);
+    return;
+#endif
+#if defined(__SSE2__)
+  case cpu::kSSE2:
+    accumulate_row_u8_sse2(row, w, acc, n);
+    return;
+#endif
+  default:
+    accumulate_row_u8_scalar(row, w, acc, n);
+  }
+}
+
+template <>
+void accumulate_row<unsigned short>(const unsigned short *row, const float &w,
+                                    float *acc, const size_t &n) {
+  switch (cpu::simd_level()) {
+#if defined(__x86_64__) || defined(__i386__)
+  case cpu::kAVX2:
+    accumulate_row_u16_avx2(row, w, acc, n);
+    return;
+#endif
+#if defined(__SSE2__)
+  case cpu::kSSE2:
+    accumulate_row_u16_sse2(row, w, acc, n);
+    return;
+#endif
+  default:
+    accumulate_row_u16_scalar(row, w, acc, n);
+  }
+}
+
+// 列方向的加权按波段数展开，C 为 0 时波段数在运行时给出
+template <typename T, int C>
+struct resample_kernel {
+  static void run(const void *source, const size_t &src_w, const size_t &src_h,
+                  const size_t &src_stride, void *target, const size_t &dst_w,
+                  const size_t &dst_h, const size_t &dst_stride,
+                  const int &nchannels, const bool &area) {
+    const int nc = pixel::channels<C>::get(nchannels);
+    const T *src = static_cast<const T *>(source);
+    T *dst = static_cast<T *>(target);
+    const resample_taps_t &&xtaps =
+        area ? area_taps(src_w, dst_w) : bilinear_taps(src_w, dst_w);
+    const resample_taps_t &&ytaps =
+        area ? area_taps(src_h, dst_h) : bilinear_taps(src_h, dst_h);
+    const float max_value = static_cast<float>(static_cast<T>(~0));
+    const size_t row_size = src_w * nc;
+    vector<float> acc(row_size);
+    for (size_t y = 0; y < dst_h; y++) {
+      std::fill(acc.begin(), acc.end(), 0.f);
+      for (int t = 0; t < ytaps.taps; t++) {
+        const float &w = ytaps.weights[y * ytaps.taps + t];
+        if (w != 0) {
+          accumulate_row(src + (ytaps.start[y] + t) * src_stride, w,
+                         acc.data(), row_size);
+        }
+      }
+      T *out = dst + y * dst_stride;
+      for (size_t x = 0; x < dst_w; x++) {
+        const float *weights = xtaps.weights.data() + x * xtaps.taps;
+        const float *in = acc.data() + xtaps.start[x] * nc;
+        for (int c = 0; c < nc; c++) {
+          float v = 0;
+          for (int t = 0; t < xtaps.taps; t++) {
+            v += weights[t] * in[t * nc + c];
+          }
+          v = std::min(std::max(v + 0.5f, 0.f), max_value);
+          out[x * nc + c] = static_cast<T>(v);
+        }
+      }
+    }
+  }
+};
+
+bool resample_supported(const GDALDataType &data_type, const string &method) {
+  return (data_type == GDT_Byte || data_type == GDT_UInt16) &&
+         (method == "auto" || method == "average" || method == "bilinear");
+}
+
+void resample_image(const void *src, const size_t &src_w, const size_t &src_h,
+                    const size_t &src_stride, void *dst, const size_t &dst_w,
+                    const size_t &dst_h, const size_t &dst_stride,
+                    const int &nchannels, const GDALDataType &data_type,
+                    const string &method) {
+  CHECK_F(resample_supported(data_type, method),
+          "unsupport resample %s for %s", method.c_str(),
+          GDALGetDataTypeName(data_type));
+  const bool area = method == "average" ||
+                    (method == "auto" && dst_w * dst_h < src_w * src_h);
+  auto kernel =
+      data_type == GDT_Byte
+          ? pixel::select_channels<pixel::bind_type<
+                resample_kernel, unsigned char>::template type>(nchannels)
+          : pixel::select_channels<pixel::bind_type<
+                resample_kernel, unsigned short>::template type>(nchannels);
+  kernel(src, src_w, src_h, src_stride, dst, dst_w, dst_h, dst_stride,
+         nchannels, area);
+}
@@ -0,0 +1,45 @@
+// 本文件以 -mavx2 编译 (见 CMakeLists.txt)，只在 cpu::simd_level() 为 AVX2 时调用
+#include "resample.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+void accumulate_row_u8_avx2(const unsigned char *row, const float &w,
+                            float *acc, const size_t &n) {
+  const __m256 _w = _mm256_set1_ps(w);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256i v = _mm256_cvtepu8_epi32(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i *>(row + i)));
+    _mm256_storeu_ps(acc + i,
+                     _mm256_add_ps(_mm256_loadu_ps(acc + i),
+                                   _mm256_mul_ps(_w, _mm256_cvtepi32_ps(v))));
+  }
+  accumulate_row_u8_scalar(row + i, w, acc + i, n - i);
+}
+
+void accumulate_row_u16_avx2(const unsigned short *row, const float &w,
+                             float *acc, const size_t &n) {
+  const __m256 _w = _mm256_set1_ps(w);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256i v = _mm256_cvtepu16_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i)));
+    _mm256_storeu_ps(acc + i,
+                     _mm256_add_ps(_mm256_loadu_ps(acc + i),
+                                   _mm256_mul_ps(_w, _mm256_cvtepi32_ps(v))));
+  }
+  accumulate_row_u16_scalar(row + i, w, acc + i, n - i);
+}
+#else
+// 编译器不支持 AVX2 时退回标量实现
+void accumulate_row_u8_avx2(const unsigned char *row, const float &w,
+                            float *acc, const size_t &n) {
+  accumulate_row_u8_scalar(row, w, acc, n);
+}
+
+void accumulate_row_u16_avx2(const unsigned short *row, const float &w,
+                             float *acc, const size_t &n) {
+  accumulate_row_u16_scalar(row, w, acc, n);
+}
+#endif
@@ -4,44 +4,37 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <cstdlib>
-#include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <list>
 #include <mutex>
-#include <numeric>
 #include <sstream>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
 #include "dota_utils.h"
+#include "encode_utils.h"
+#include "grid_index.hpp"
 #include "loguru.hpp"
 #include "path_utils.hpp"
 #include "poly_iou.hpp"
+#include "read_utils.h"
+#include "rect_iof.h"
+#include "resample.h"
 #include "string_utils.hpp"
+#include "threadpool.hpp"
 
 using std::endl;
 using std::list;
 using std::string;
 using std::vector;
 
-string get_gdal_image_type(const string &file) {
-  static const std::unordered_map<string, string> suffix2gdal{{
-      {"png", "PNG"},
-      {"bmp", "BMP"},
-      {"jpg", "JPEG"},
-      {"tif", "GTiff"},
-      {"tiff", "GTiff"},
-  }};
-  const string file_suffix = str::tolower(path::suffix(file));
-  if (suffix2gdal.find(file_suffix) == suffix2gdal.end()) {
-    return "";
-  }
-  const string &gdal_type = suffix2gdal.at(file_suffix);
-  return gdal_type;
-}
+// read_mode 为 "auto" 时条带的内存上限，条带高度按窗口尺寸加一个块行估计
+static const double kMaxStripBytes = 1 << 30;
+static const size_t kStripMargin = 512;
 
 list<vector<size_t>> get_sliding_window(const content_t &info,
                                         const vector<int> sizes,
@@ -50,9 +43,9 @@ list<vector<size_t>> get_sliding_window(const content_t &info,
   const size_t &width = info.width;
   const size_t &height = info.height;
   list<vector<size_t>> windows;
-  for (size_t i = 0; i < sizes.size(); i++) {
-    const auto size = static_cast<size_t>(sizes[i]);
-    const auto gap = static_cast<size_t>(gaps[i]);
+  for (size_t k = 0; k < sizes.size(); k++) {
+    const auto size = static_cast<size_t>(sizes[k]);
+    const auto gap = static_cast<size_t>(gaps[k]);
     CHECK_F(size > gap, "invalid size gap pair [%ld %ld]", size, gap);
     const size_t step = size - gap;
 
@@ -95,219 +88,433 @@ list<vector<size_t>> get_sliding_window(const content_t &info,
             img_rate < img_rate_thr) {
           continue;
         }
-        windows.push_back(vector<size_t>{x1, y1, x2, y2});
+        windows.push_back(vector<size_t>{x1, y1, x2, y2, k});
       }
     }
   }
   return windows;
 }
 
-vector<vector<double>> obj_overlaps_iof(const list<vector<size_t>> &bboxes1,
-                                        const vector<vector<double>> &bboxes2) {
-  const auto rows = bboxes1.size();
-  const auto cols = bboxes2.size();
-  if (rows * cols == 0) {
-    return vector<vector<double>>(rows, vector<double>(cols, 0));
+// 每个窗口只保存外接框相交的候选对象 (对象下标, iof)，下标升序
+vector<vector<std::pair<size_t, double>>>
+obj_overlaps_iof(const content_t &info, const list<vector<size_t>> &bboxes1,
+                 const vector<double> &bboxes2, const string &iof_kernel) {
+  const bool batch_kernel = iof_kernel == "batch";
+  const bool aabb_kernel = iof_kernel == "aabb";
+  CHECK_F(batch_kernel || aabb_kernel || iof_kernel == "general",
+          "unsupport iof_kernel %s", iof_kernel.c_str());
+  vector<vector<std::pair<size_t, double>>> iofs(bboxes1.size());
+  if (bboxes1.empty() || bboxes2.empty()) {
+    return iofs;
+  }
+  size_t min_size = info.width + info.height;
+  for (auto &tb : bboxes1) {
+    min_size = std::min(min_size, std::min(tb[2] - tb[0], tb[3] - tb[1]));
   }
-  vector<vector<double>> iofs(rows, vector<double>(cols, 0));
+  // 网格边长取最小窗口的一半，超大影像时限制网格数量
+  const double cell_size =
+      std::max(min_size / 2.,
+               std::sqrt(static_cast<double>(info.width) * info.height /
+                         (1 << 20)));
+  spatial::grid_index index(0, 0, info.width, info.height, cell_size);
+  const size_t num_objs = bboxes2.size() / 8;
+  for (size_t j = 0; j < num_objs; j++) {
+    auto bbox = bboxes2.data() + 8 * j;
+    double x1 = bbox[0], y1 = bbox[1], x2 = bbox[0], y2 = bbox[1];
+    for (size_t k = 2; k < 8; k += 2) {
+      x1 = std::min(x1, bbox[k]);
+      x2 = std::max(x2, bbox[k]);
+      y1 = std::min(y1, bbox[k + 1]);
+      y2 = std::max(y2, bbox[k + 1]);
+    }
+    index.insert(j, x1, y1, x2, y2);
+  }
+
+  vector<size_t> candidates;
+  vector<double> soa[8]; // 候选对象按顶点坐标分开存放，供批量内核使用
+  vector<double> batch_iofs;
   int i = 0;
   for (auto &tb : bboxes1) {
-    for (size_t j = 0; j < cols; j++) {
-      double tx = static_cast<double>(tb[0]), ty = static_cast<double>(tb[1]),
-             tw = static_cast<double>(tb[2] - tb[0]),
-             th = static_cast<double>(tb[3] - tb[1]);
-      double bbox1[8]{tx,      ty,      tx + tw, ty,
-                      tx + tw, ty + th, tx,      ty + th}; // 顺时针
-      auto bbox2 = bboxes2[j].data();
-      iofs[i][j] =
-          std::single_poly_iou_rotated<double>(bbox2, bbox1, std::kIoF);
+    double tx = static_cast<double>(tb[0]), ty = static_cast<double>(tb[1]),
+           tw = static_cast<double>(tb[2] - tb[0]),
+           th = static_cast<double>(tb[3] - tb[1]);
+    double bbox1[8]{tx,      ty,      tx + tw, ty,
+                    tx + tw, ty + th, tx,      ty + th}; // 顺时针
+    index.query(tx, ty, tx + tw, ty + th, candidates);
+    iofs[i].reserve(candidates.size());
+    if (batch_kernel) {
+      const size_t n = candidates.size();
+      quads_t quads;
+      for (size_t k = 0; k < 8; k++) {
+        soa[k].resize(n);
+        for (size_t c = 0; c < n; c++) {
+          soa[k][c] = bboxes2[8 * candidates[c] + k];
+        }
+      }
+      for (size_t k = 0; k < 4; k++) {
+        quads.x[k] = soa[2 * k].data();
+        quads.y[k] = soa[2 * k + 1].data();
+      }
+      quads.size = n;
+      batch_iofs.resize(n);
+      rect_iof_batch(quads, tx, ty, tx + tw, ty + th, batch_iofs.data());
+      for (size_t c = 0; c < n; c++) {
+        iofs[i].emplace_back(candidates[c], batch_iofs[c]);
+      }
+      i++;
+      continue;
+    }
+    for (auto &j : candidates) {
+      auto bbox2 = bboxes2.data() + 8 * j;
+      iofs[i].emplace_back(
+          j, aabb_kernel ? std::poly_rect_iof<double>(bbox2, tx, ty, tx + tw,
+                                                      ty + th)
+                         : std::single_poly_iou_rotated<double>(bbox2, bbox1,
+                                                                std::kIoF));
     }
     i++;
   }
   return iofs;
 }
 
-vector<ann_t> get_window_obj(const content_t &info,
-                             const list<vector<size_t>> windows,
-                             const float &iof_thr) {
+vector<window_ann_t> get_window_obj(const content_t &info,
+                                    const list<vector<size_t>> windows,
+                                    const float &iof_thr,
+                                    const string &iof_kernel) {
   double eps = 1e-6;
   const auto &bboxes = info.ann.bboxes;
-  const auto &&iofs = obj_overlaps_iof(windows, bboxes);
-  vector<ann_t> window_anns;
-  window_anns.reserve(windows.size());
+  const auto &&iofs = obj_overlaps_iof(info, windows, bboxes, iof_kernel);
+  vector<window_ann_t> window_anns(windows.size());
   for (size_t i = 0; i < windows.size(); i++) {
-    const auto &win_iofs = iofs[i];
-    ann_t window_ann;
-    for (size_t j = 0; j < win_iofs.size(); j++) {
-      if (win_iofs[j] >= static_cast<double>(iof_thr)) {
-        window_ann.bboxes.push_back(info.ann.bboxes[j]);
-        window_ann.labels.push_back(info.ann.labels[j]);
-        window_ann.diffs.push_back(info.ann.diffs[j]);
-        window_ann.trunc.push_back(std::fabs(win_iofs[j] - 1) > eps);
+    auto &window_ann = window_anns[i];
+    for (auto &iof : iofs[i]) {
+      if (iof.second >= static_cast<double>(iof_thr)) {
+        window_ann.inds.push_back(static_cast<unsigned int>(iof.first));
+        window_ann.trunc.push_back(std::fabs(iof.second - 1) > eps);
       }
     }
-    window_anns.push_back(window_ann);
   }
   return window_anns;
 }
 
-size_t
-crop_and_save_img(const content_t &info, const list<vector<size_t>> &windows,
-                  const vector<ann_t> &window_anns, const string &img_dir,
-                  const bool &no_padding, const vector<float> &padding_value,
-                  const string &save_dir, const string &anno_dir,
-                  const string &img_ext, const float &ignore_empty_prob) {
-  auto img_file = img_dir + info.filename;
-  GDALDataset *dataset =
-      static_cast<GDALDataset *>(GDALOpen(img_file.c_str(), GA_ReadOnly));
-  const auto tmp_band = dataset->GetRasterBand(1);
-  const auto data_type = tmp_band->GetRasterDataType();
-  const size_t data_size = GDALGetDataTypeSizeBytes(data_type);
-  const auto nchannels = dataset->GetRasterCount();
+bool use_block_reader(const content_t &info, const split_cfg_t &cfg,
+                      const size_t &num_strips) {
+  if (cfg.read_mode != "auto") {
+    return cfg.read_mode == "block";
+  }
+  const size_t max_size =
+      static_cast<size_t>(*std::max_element(cfg.sizes.begin(), cfg.sizes.end()));
+  const double strip_bytes = static_cast<double>(info.width) *
+                             (max_size + kStripMargin) * info.nchannels *
+                             GDALGetDataTypeSizeBytes(info.data_type);
+  return strip_bytes * num_strips <= kMaxStripBytes;
+}
 
-  size_t i = 0;
-  size_t num_patches = 0;
+double estimate_cost(const content_t &info, const split_cfg_t &cfg) {
+  static const std::unordered_map<string, double> decode_weights{
+      {"NONE", 0.1},    {"PACKBITS", 0.2}, {"LZW", 0.6}, {"DEFLATE", 0.6},
+      {"ZSTD", 0.4},    {"LERC", 0.6},     {"JPEG", 1.0}, {"WEBP", 1.2},
+      {"JPEG2000", 4.}, {"JP2OPENJPEG", 4.}};
+  auto it = decode_weights.find(info.compression);
+  const double decode_weight = it == decode_weights.end() ? 0.6 : it->second;
+  const double encode_weight = cfg.img_ext == ".png" ? 1.0 : 0.5;
+
+  double read_pixels = 0, write_pixels = 0;
+  for (auto &window : get_sliding_window(info, cfg.sizes, cfg.gaps,
+                                         cfg.img_rate_thr)) {
+    const double clipped =
+        static_cast<double>(std::min(window[2], info.width) - window[0]) *
+        (std::min(window[3], info.height) - window[1]);
+    read_pixels += clipped;
+    const double padded = static_cast<double>(window[2] - window[0]) *
+                          (window[3] - window[1]);
+    const double scale =
+        cfg.rescale ? static_cast<double>(cfg.out_sizes[window[4]]) /
+                          cfg.sizes[window[4]]
+                    : 1.;
+    write_pixels += (cfg.no_padding ? clipped : padded) * scale * scale;
+  }
+  if (use_block_reader(info, cfg)) {
+    read_pixels = static_cast<double>(info.width) * info.height;
+  }
+  const double pixel_bytes = static_cast<double>(info.nchannels) *
+                             GDALGetDataTypeSizeBytes(info.data_type);
+  return (read_pixels * decode_weight + write_pixels * encode_weight) *
+         pixel_bytes;
+}
 
+vector<window_t> plan_windows(const content_t &info, const split_cfg_t &cfg) {
+  auto &&windows =
+      get_sliding_window(info, cfg.sizes, cfg.gaps, cfg.img_rate_thr);
+  auto &&window_anns =
+      get_window_obj(info, windows, cfg.iof_thr, cfg.iof_kernel);
+
+  // 先按原顺序决定丢弃的空窗口，保证随机序列与读取顺序无关
+  vector<window_t> plan;
+  plan.reserve(windows.size());
+  size_t i = 0;
   for (auto &window : windows) {
     auto &ann = window_anns[i++];
-    if (ann.labels.empty() &&
-        static_cast<float>(rand() % 10000) / 10000 < ignore_empty_prob) {
+    if (ann.inds.empty() &&
+        static_cast<float>(rand() % 10000) / 10000 < cfg.ignore_empty_prob) {
       continue;
     }
-    const auto &x_start = window[0];
-    const auto &y_start = window[1];
-    const auto &x_stop = window[2];
-    const auto &y_stop = window[3];
-    std::stringstream id_ss;
-    id_ss << info.id << "__" << x_stop - x_start << "__" << x_start << "___"
-          << y_start;
-    const string &id = id_ss.str();
-    auto &_bboxes = ann.bboxes;
-    auto &labels = ann.labels;
-    list<vector<double>> bboxes;
-    {
-      for (auto &_bbox : _bboxes) {
-        vector<double> bbox(_bbox.size(), 0);
-        for (int j = 0; j < static_cast<int>(_bbox.size()); j++) {
-          bbox[j] = j % 2 == 0 ? _bbox[j] - x_start : _bbox[j] - y_start;
-        }
-        bboxes.push_back(bbox);
-      }
+    const double scale =
+        cfg.rescale ? static_cast<double>(cfg.out_sizes[window[4]]) /
+                          cfg.sizes[window[4]]
+                    : 1.;
+    plan.push_back(
+        window_t{window[0], window[1], window[2], window[3], scale});
+    plan.back().ann.inds.swap(ann.inds);
+    plan.back().ann.trunc.swap(ann.trunc);
+  }
+  if (use_block_reader(info, cfg)) {
+    std::stable_sort(plan.begin(), plan.end(),
+                     [](const window_t &a, const window_t &b) {
+                       return a.y_start < b.y_start;
+                     });
+  }
+  return plan;
+}
+
+// 把像素交错的 src 缩放到 buf_x × buf_y 写入 patch 左上角，尺寸相同时直接拷贝
+static void resample_view(const image_view_t &src, patch_t &patch,
+                          const size_t &buf_x, const size_t &buf_y,
+                          const split_cfg_t &cfg, const double &scale) {
+  const size_t pixel_size = patch.nchannels * patch.data_size;
+  if (src.width == buf_x && src.height == buf_y) {
+    for (size_t y = 0; y < buf_y; y++) {
+      memcpy(patch.data.data() + y * patch.width * pixel_size,
+             src.data + y * src.line_size, buf_x * pixel_size);
     }
+  } else if (cfg.resample_engine == "builtin" &&
+             resample_supported(patch.data_type, cfg.resample)) {
+    resample_image(src.data, src.width, src.height,
+                   src.line_size / patch.data_size, patch.data.data(), buf_x,
+                   buf_y, patch.width * patch.nchannels, patch.nchannels,
+                   patch.data_type, cfg.resample);
+  } else {
+    GDALDataset *mem_dataset =
+        wrap_buffer(src.data, src.width, src.height, patch.nchannels,
+                    patch.data_type, src.line_size);
+    read_window(mem_dataset, 0, 0, src.width, src.height, patch, buf_x, buf_y,
+                get_resample_alg(cfg.resample, scale));
+    GDALClose(static_cast<GDALDatasetH>(mem_dataset));
+  }
+}
 
-    const size_t &width = info.width;
-    const size_t &height = info.height;
-    const auto _x_stop = std::min(x_stop, width);
-    const auto _y_stop = std::min(y_stop, height);
-    const auto x_num = _x_stop - x_start;
-    const auto y_num = _y_stop - y_start;
+std::unique_ptr<depth_converter> make_depth_converter(GDALDataset *dataset,
+                                                      const split_cfg_t &cfg) {
+  if (cfg.to_8bit == "none") {
+    return nullptr;
+  }
+  return std::unique_ptr<depth_converter>(new depth_converter(
+      dataset->GetRasterBand(1)->GetRasterDataType(), dataset->GetRasterCount(),
+      compute_stretch(dataset, cfg.to_8bit, cfg.stretch_percent), cfg.gamma));
+}
 
-    const string &save_img_file = save_dir + id + img_ext;
-    {
-      const size_t img_height = y_stop - y_start;
-      const size_t img_width = x_stop - x_start;
-      const size_t _x_num = !no_padding ? img_width : x_num;
-      const size_t _y_num = !no_padding ? img_height : y_num;
+void read_patch(const content_t &info, const window_t &window,
+                const split_cfg_t &cfg, GDALDataset *dataset,
+                block_reader *reader, patch_t &patch,
+                const depth_converter *converter) {
+  const auto data_type = dataset->GetRasterBand(1)->GetRasterDataType();
+  const auto nchannels = dataset->GetRasterCount();
+  const auto &x_start = window.x_start;
+  const auto &y_start = window.y_start;
+  const auto x_num = std::min(window.x_stop, info.width) - x_start;
+  const auto y_num = std::min(window.y_stop, info.height) - y_start;
+  if (window.scale != 1) {
+    const size_t out_size =
+        std::lround((window.x_stop - x_start) * window.scale);
+    const size_t buf_x = std::min<size_t>(std::lround(x_num * window.scale),
+                                          out_size);
+    const size_t buf_y = std::min<size_t>(std::lround(y_num * window.scale),
+                                          out_size);
+    init_patch(patch, !cfg.no_padding ? out_size : buf_x,
+               !cfg.no_padding ? out_size : buf_y, nchannels, data_type);
+    if (reader != nullptr) {
+      // 从共享条带或其降采样层缩放，所有尺寸和比例的窗口共用一次解码。
+      // 降采样层上的区域只在起点和尺寸都为偶数时与窗口对齐，否则图像会相对
+      // 标注偏移最多一个原图像素，此时退回原分辨率条带
+      const bool aligned =
+          (x_start | y_start | x_num | y_num) % 2 == 0;
+      const int level =
+          reader->has_pyramid() && window.scale <= 0.5 && aligned ? 1 : 0;
+      resample_view(reader->view(x_start, y_start, x_num, y_num, level), patch,
+                    buf_x, buf_y, cfg, level == 1 ? 2 * window.scale
+                                                  : window.scale);
+    } else if (cfg.resample_engine == "builtin" &&
+               resample_supported(data_type, cfg.resample)) {
+      // 按原分辨率读取，再用内置内核缩放
+      static thread_local patch_t source;
+      init_patch(source, x_num, y_num, nchannels, data_type);
+      read_window(dataset, x_start, y_start, x_num, y_num, source);
+      const size_t line_size = x_num * nchannels * source.data_size;
+      resample_view(image_view_t{source.data.data(), x_num, y_num, line_size},
+                    patch, buf_x, buf_y, cfg, window.scale);
+    } else {
+      // 直接按输出尺寸读取，缩小时 GDAL 可以利用概览，只读取需要的像素
+      read_window(dataset, x_start, y_start, x_num, y_num, patch, buf_x, buf_y,
+                  get_resample_alg(cfg.resample, window.scale));
+    }
+    if (converter != nullptr) {
+      converter->convert(patch);
+    }
+    pad_patch(patch, buf_x, buf_y, cfg.padding_mode, cfg.padding_value);
+    return;
+  }
+  const size_t _x_num = !cfg.no_padding ? window.x_stop - x_start : x_num;
+  const size_t _y_num = !cfg.no_padding ? window.y_stop - y_start : y_num;
 
-      const string &out_gdal_type = get_gdal_image_type(save_img_file);
-      CHECK_F(!out_gdal_type.empty(), "unsupport type %s ",
-              path::suffix(save_img_file).c_str());
+  init_patch(patch, _x_num, _y_num, nchannels, data_type);
+  if (reader != nullptr) {
+    reader->read(x_start, y_start, x_num, y_num, patch);
+  } else {
+    read_window(dataset, x_start, y_start, x_num, y_num, patch);
+  }
+  if (converter != nullptr) {
+    converter->convert(patch);
+  }
+  // 只有越过图像右边界或下边界的窗口需要填充
+  pad_patch(patch, x_num, y_num, cfg.padding_mode, cfg.padding_value);
+}
 
-      GDALDriver *mem_driver;
-      mem_driver = GetGDALDriverManager()->GetDriverByName("MEM");
-      CHECK_F(mem_driver != nullptr, "GetDriverByName \"MEM\": %s",
-              CPLGetLastErrorMsg());
-      GDALDataset *mem_dataset =
-          mem_driver->Create("", _x_num, _y_num, nchannels, data_type, nullptr);
+void save_patch(const content_t &info, const window_t &window,
+                const patch_t &patch, const split_cfg_t &cfg, encoder &enc,
+                vector<unsigned char> &encoded, class_stats_t &stats) {
+  const auto &x_start = window.x_start;
+  const auto &y_start = window.y_start;
+  auto &ann = window.ann;
+  std::stringstream id_ss;
+  id_ss << info.id << "__" << window.x_stop - x_start << "__" << x_start
+        << "___" << y_start;
+  const string &id = id_ss.str();
 
-      void *buf = malloc(_x_num * _y_num * data_size);
-      for (int j = 1; j <= nchannels; j++) {
-        auto src_band = dataset->GetRasterBand(j); // RGB
-        auto dst_band = mem_dataset->GetRasterBand(j);
-        const int pi =
-            padding_value.size() - (j - 1) % padding_value.size() - 1;
+  enc.encode(patch, encoded);
+  if (cfg.tar) {
+    // 图像和 dota 标注作为相邻成员写入本线程的分片
+    auto &writer = cfg.tar->writer();
+    writer.begin_sample();
+    writer.add(id + cfg.img_ext, reinterpret_cast<const char *>(encoded.data()),
+               encoded.size());
+  } else if (!cfg.db) {
+    write_file(cfg.save_dir + id + cfg.img_ext, encoded);
+  }
 
-        memset(buf, static_cast<unsigned char>(padding_value[pi]),
-               _x_num * _y_num * data_size);
-        CPLErr ret;
-        ret =
-            src_band->RasterIO(GF_Read, x_start, y_start, x_num, y_num, buf,
-                               x_num, y_num, data_type, 0, data_size * _x_num);
-        CHECK_F(ret < CE_Failure, "RasterIO %s: %s", info.filename.c_str(),
-                CPLGetLastErrorMsg());
-        ret = dst_band->RasterIO(GF_Write, 0, 0, _x_num, _y_num, buf, _x_num,
-                                 _y_num, data_type, 0, 0);
-        CHECK_F(ret < CE_Failure, "RasterIO %s: %s", info.filename.c_str(),
-                CPLGetLastErrorMsg());
+  if (!cfg.ann_sinks.empty() || cfg.db) {
+    // 每个线程复用一份 patch 标注，坐标换算到 patch 上
+    static thread_local patch_ann_t record;
+    record.id = id;
+    record.file_name = id + cfg.img_ext;
+    record.width = patch.width;
+    record.height = patch.height;
+    record.bboxes.resize(8 * ann.inds.size());
+    record.labels.resize(ann.inds.size());
+    record.diffs.resize(ann.inds.size());
+    record.trunc.assign(ann.trunc.begin(), ann.trunc.end());
+    for (size_t j = 0; j < ann.inds.size(); j++) {
+      const size_t &obj = ann.inds[j];
+      const double *_bbox = info.ann.bboxes.data() + 8 * obj;
+      for (int k = 0; k < 8; k++) {
+        record.bboxes[8 * j + k] =
+            (k % 2 == 0 ? _bbox[k] - x_start : _bbox[k] - y_start) *
+            window.scale;
       }
-      free(buf);
-
-      GDALDriver *out_driver;
-      out_driver =
-          GetGDALDriverManager()->GetDriverByName(out_gdal_type.c_str());
-
-      auto out_dataset = out_driver->CreateCopy(
-          save_img_file.c_str(), mem_dataset, FALSE, nullptr, nullptr, nullptr);
-
-      CHECK_F(out_dataset != nullptr, "CreateCopy %s: %s",
-              save_img_file.c_str(), CPLGetLastErrorMsg());
-
-      GDALClose(static_cast<GDALDatasetH>(mem_dataset));
-      GDALClose(static_cast<GDALDatasetH>(out_dataset));
+      record.labels[j] = info.ann.labels[obj];
+      record.diffs[j] = info.ann.diffs[obj];
+    }
+    for (auto &sink : cfg.ann_sinks) {
+      sink->write(record);
+    }
+    if (cfg.db) {
+      cfg.db->write(info.id, window.x_stop - x_start, x_start, y_start, encoded,
+                    record);
+    }
+  }
+  for (auto &obj : ann.inds) {
+    const size_t label = info.ann.labels[obj];
+    if (stats.size() <= label) {
+      stats.resize(label + 1, 0);
     }
+    stats[label]++;
+  }
+}
 
-    if (!anno_dir.empty()) {
-      const string &save_ann_file = anno_dir + id + ".txt";
-      std::ofstream output_file(save_ann_file);
-      size_t j = 0;
-      for (auto &bbox : bboxes) {
-        auto outline =
-            std::accumulate(bbox.begin(), bbox.end(), string(""),
-                            [](string &lhs, const int &rhs) {
-                              return lhs.empty()
-                                         ? std::to_string(rhs)
-                                         : lhs + " " + std::to_string(rhs);
-                            });
-        const char diff = !ann.trunc[j] ? ann.diffs[j] + '0' : '2';
-        output_file << outline << " " << labels[j] << " " << diff;
-        if (j < bboxes.size() - 1) {
-          output_file << endl;
-        }
-        j++;
-      }
+size_t crop_and_save_img(const content_t &info, const vector<window_t> &plan,
+                         const string &img_dir, const split_cfg_t &cfg,
+                         class_stats_t &stats) {
+  dataset_pool datasets(img_dir + info.filename);
+  GDALDataset *first = datasets.acquire();
+  auto &&converter = make_depth_converter(first, cfg);
+  datasets.release(first);
+  // 窗口并行时每个执行者同时持有一个条带，auto 按总内存决定是否块读取
+  auto &pool = std::threadpool::instance();
+  const bool parallel = cfg.window_parallel && plan.size() >= 2;
+  const size_t num_runners =
+      parallel ? std::min(plan.size(), static_cast<size_t>(pool.thrCount() + 1))
+               : 1;
+  const bool use_block = use_block_reader(info, cfg, num_runners);
+  // 按顺序处理 plan 中的 [begin, end)，块模式下同一段窗口共享一个条带
+  auto save_range = [&info, &plan, &cfg, &datasets, &converter, &use_block](
+                        const size_t &begin, const size_t &end,
+                        class_stats_t &_stats) {
+    GDALDataset *dataset = datasets.acquire();
+    block_reader reader(dataset, cfg.pyramid && cfg.rescale);
+    block_reader *_reader = use_block ? &reader : nullptr;
+    encoder &enc = get_encoder(cfg.img_ext, cfg.save_options);
+    patch_t patch;
+    vector<unsigned char> encoded;
+    for (size_t i = begin; i < end; i++) {
+      read_patch(info, plan[i], cfg, dataset, _reader, patch, converter.get());
+      save_patch(info, plan[i], patch, cfg, enc, encoded, _stats);
     }
-    num_patches++;
+    datasets.release(dataset);
+  };
+
+  if (!parallel) {
+    save_range(0, plan.size(), stats);
+    return plan.size();
   }
-  GDALClose(static_cast<GDALDatasetH>(dataset));
-  return num_patches;
+  // 窗口切成连续的段分给线程池，每段独立打开句柄、读取和编码。
+  // 块模式下相邻段的条带在交界处会重复解码，每个执行者只取一段以减少交界；
+  // 逐窗口读取时切得更细以均衡负载
+  const size_t num_chunks = use_block ? num_runners
+                                      : std::min(plan.size(), 4 * num_runners);
+  const size_t grain = (plan.size() + num_chunks - 1) / num_chunks;
+  std::mutex lock;
+  pool.parallel_for(0, (plan.size() + grain - 1) / grain, 1,
+                    [&plan, &grain, &save_range, &lock, &stats](size_t c) {
+                      class_stats_t _stats;
+                      save_range(c * grain,
+                                 std::min(plan.size(), (c + 1) * grain),
+                                 _stats);
+                      std::lock_guard<std::mutex> lg(lock);
+                      merge_class_stats(_stats, stats);
+                    });
+  return plan.size();
 }
 
 size_t single_split(const std::pair<content_t, string> &arguments,
-                    const vector<int> &sizes, const vector<int> &gaps,
-                    const float &img_rate_thr, const float &iof_thr,
-                    const bool &no_padding, const vector<float> &padding_value,
-                    const string &save_dir, const string &anno_dir,
-                    const string &img_ext, const float &ignore_empty_prob,
-                    const size_t &total, size_t &prog, std::mutex &lock) {
+                    const split_cfg_t &cfg, const size_t &total, size_t &prog,
+                    class_stats_t &stats, std::mutex &lock) {
   srand(4096);
 
   auto &info = arguments.first;
   auto &img_dir = arguments.second;
-  auto &&windows = get_sliding_window(info, sizes, gaps, img_rate_thr);
-  auto &&window_anns = get_window_obj(info, windows, iof_thr);
-  size_t num_patches = crop_and_save_img(info, windows, window_anns, img_dir,
-                                         no_padding, padding_value, save_dir,
-                                         anno_dir, img_ext, ignore_empty_prob);
+  auto &&plan = plan_windows(info, cfg);
+  class_stats_t _stats;
+  size_t num_patches = crop_and_save_img(info, plan, img_dir, cfg, _stats);
 
   std::lock_guard<std::mutex> lg(lock);
   prog += 1;
+  merge_class_stats(_stats, stats);
   LOG(INFO) << std::setiosflags(std::ios::fixed) << std::setprecision(2)
             << static_cast<float>(prog) / total * 100 << "%"
             << " " << prog << ":" << total << " - "
             << "filename: " << info.filename << " - "
             << "width: " << info.width << " - "
             << "height: " << info.height << " - "
-            << "objects: " << info.ann.bboxes.size() << " - "
+            << "objects: " << info.ann.labels.size() << " - "
             << "patches: " << num_patches << endl;
   return num_patches;
 }
@@ -0,0 +1,135 @@
+#include "tar_writer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "loguru.hpp"
+
+using std::string;
+
+// tar 以 512 字节为块，结尾为两个全零块
+static const size_t kBlockSize = 512;
+static const size_t kWriteBufferSize = 1 << 20;
+
+tar_writer::tar_writer(const string &prefix, const size_t &max_size,
+                       const size_t &max_count)
+    : _prefix(prefix), _max_size(max_size), _max_count(max_count), _seq(0),
+      _tar(nullptr), _index(nullptr), _offset(0), _count(0) {}
+
+tar_writer::~tar_writer() { close(); }
+
+void tar_writer::open_shard() {
+  char seq[16];
+  snprintf(seq, sizeof(seq), "-%06zu", _seq++);
+  _tar_file = _prefix + seq + ".tar";
+  _tar = fopen(_tar_file.c_str(), "wb");
+  CHECK_F(_tar != nullptr, "fopen %s: %s", _tar_file.c_str(), strerror(errno));
+  setvbuf(_tar, nullptr, _IOFBF, kWriteBufferSize);
+  const string index_file = _prefix + seq + ".idx";
+  _index = fopen(index_file.c_str(), "w");
+  CHECK_F(_index != nullptr, "fopen %s: %s", index_file.c_str(),
+          strerror(errno));
+  _offset = 0;
+  _count = 0;
+}
+
+void tar_writer::begin_sample() {
+  if (_tar != nullptr && ((_max_size > 0 && _offset >= _max_size) ||
+                          (_max_count > 0 && _count >= _max_count))) {
+    close();
+  }
+  if (_tar == nullptr) {
+    open_shard();
+  }
+  _count++;
+}
+
+void tar_writer::write_padded(const char *data, const size_t &size) {
+  static const char zeros[kBlockSize] = {0};
+  if (size > 0) {
+    CHECK_F(fwrite(data, 1, size, _tar) == size, "fwrite %s: %s",
+            _tar_file.c_str(), strerror(errno));
+  }
+  const size_t padding = (kBlockSize - size % kBlockSize) % kBlockSize;
+  if (padding > 0) {
+    CHECK_F(fwrite(zeros, 1, padding, _tar) == padding, "fwrite %s: %s",
+            _tar_file.c_str(), strerror(errno));
+  }
+  _offset += size + padding;
+}
+
+// ustar 头，超过 99 个字符的文件名先写一个 GNU 长文件名 ('L') 记录
+void tar_writer::write_header(const string &name, const size_t &size,
+                              const char &type) {
+  if (name.size() > 99) {
+    write_header("././@LongLink", name.size() + 1, 'L');
+    write_padded(name.c_str(), name.size() + 1);
+  }
+  char header[kBlockSize] = {0};
+  memcpy(header, name.c_str(), std::min<size_t>(name.size(), 99));
+  snprintf(header + 100, 8, "%07o", 0644);
+  snprintf(header + 108, 8, "%07o", 0);
+  snprintf(header + 116, 8, "%07o", 0);
+  snprintf(header + 124, 12, "%011llo", static_cast<unsigned long long>(size));
+  snprintf(header + 136, 12, "%011o", 0); // mtime 为 0，输出可以逐字节比较
+  header[156] = type;
+  memcpy(header + 257, "ustar", 6);
+  memcpy(header + 263, "00", 2);
+  // 校验和按校验和字段全为空格计算
+  memset(header + 148, ' ', 8);
+  unsigned int checksum = 0;
+  for (size_t i = 0; i < kBlockSize; i++) {
+    checksum += static_cast<unsigned char>(header[i]);
+  }
+  snprintf(header + 148, 8, "%06o", checksum);
+  header[155] = ' ';
+  write_padded(header, kBlockSize);
+}
+
+void tar_writer::add(const string &name, const char *data, const size_t &size) {
+  CHECK_F(_tar != nullptr, "tar_writer::add before begin_sample");
+  write_header(name, size, '0');
+  fprintf(_index, "%s %zu %zu\n", name.c_str(), _offset, size);
+  write_padded(data, size);
+}
+
+void tar_writer::close() {
+  if (_tar == nullptr) {
+    return;
+  }
+  static const char zeros[2 * kBlockSize] = {0};
+  CHECK_F(fwrite(zeros, 1, sizeof(zeros), _tar) == sizeof(zeros),
+          "fwrite %s: %s", _tar_file.c_str(), strerror(errno));
+  CHECK_F(fclose(_tar) == 0, "fclose %s: %s", _tar_file.c_str(),
+          strerror(errno));
+  fclose(_index);
+  _tar = nullptr;
+  _index = nullptr;
+}
+
+tar_output::tar_output(const string &dir, const size_t &max_size,
+                       const size_t &max_count)
+    : _dir(dir), _max_size(max_size), _max_count(max_count) {}
+
+tar_writer &tar_output::writer() {
+  static thread_local tar_output *owner = nullptr;
+  static thread_local tar_writer *current = nullptr;
+  if (owner != this) {
+    std::lock_guard<std::mutex> lg(_lock);
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "shard-%02zu", _writers.size());
+    _writers.emplace_back(
+        new tar_writer(_dir + prefix, _max_size, _max_count));
+    owner = this;
+    current = _writers.back().get();
+  }
+  return *current;
+}
+
+void tar_output::close() {
+  std::lock_guard<std::mutex> lg(_lock);
+  for (auto &writer : _writers) {
+    writer->close();
+  }
+}